@@ -0,0 +1,56 @@
+// SPDX-FileCopyrightText: 2024 Peder Toftegaard Olsen
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <Arduino.h>
+#include <IPAddress.h>
+
+// Number of clients for which a rate limit is tracked
+#define ACCESS_CONTROL_MAX_CLIENTS 8
+
+namespace RidenDongle
+{
+
+struct ClientBucket {
+    uint32_t ip;
+    uint32_t tokens;          // Available requests in 1/1000 units
+    unsigned long updated_at; // millis() when tokens was last refilled
+};
+
+/**
+ * @brief Allow-list and per-client rate limiting.
+ *
+ * The allow-list and rate limits are read from RidenConfig,
+ * so changes made on the configuration page take effect
+ * immediately. A single instance is shared by all servers, so
+ * a client's rate limit covers its requests to every service.
+ */
+class RidenAccessControl
+{
+  public:
+    /**
+     * @brief Whether the client may connect at all.
+     *
+     * @param ip IP-address of the client.
+     */
+    bool is_allowed(const IPAddress &ip);
+
+    /**
+     * @brief Account for a single request from the client.
+     *
+     * @param ip IP-address of the client.
+     * @return false if the client has exceeded its rate limit and the request must be rejected.
+     */
+    bool consume(const IPAddress &ip);
+
+  private:
+    ClientBucket buckets[ACCESS_CONTROL_MAX_CLIENTS] = {};
+
+    ClientBucket &get_bucket(uint32_t ip, uint32_t capacity);
+};
+
+extern RidenAccessControl riden_access_control;
+
+} // namespace RidenDongle
@@ -0,0 +1,79 @@
+// SPDX-FileCopyrightText: 2024 Peder Toftegaard Olsen
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <riden_modbus/riden_modbus.h>
+
+#define ACQUISITION_MAX_POINTS 256
+#define ACQUISITION_DEFAULT_POINTS 100
+#define ACQUISITION_DEFAULT_INTERVAL_MS 100
+// UART bytes per sample: the read request, the response with four
+// registers, and the silent interval after each
+#define ACQUISITION_SAMPLE_BYTES 28
+// Allowance for the power supply to answer a read
+#define ACQUISITION_RESPONSE_MS 10
+
+namespace RidenDongle
+{
+
+/**
+ * @brief Buffered acquisition of the power supply output.
+ *
+ * Once started, output voltage, current and power are sampled
+ * at a fixed interval on the dongle until the configured number
+ * of points has been acquired.
+ */
+class RidenAcquisition
+{
+  public:
+    explicit RidenAcquisition(RidenModbus &riden_modbus) : riden_modbus(riden_modbus) {}
+    bool begin();
+    bool loop();
+
+    bool set_points(uint16_t points);
+    uint16_t get_points() { return points; }
+    /**
+     * @brief Set the sample interval, no shorter than get_min_interval_ms().
+     */
+    bool set_interval_ms(uint32_t interval_ms);
+    uint32_t get_interval_ms() { return interval_ms; }
+    /**
+     * @brief Shortest interval in which a sample can be read at the
+     * configured UART baud rate.
+     */
+    uint32_t get_min_interval_ms();
+
+    /**
+     * @brief Discard any samples and start a new acquisition.
+     */
+    void start();
+    void abort();
+    bool is_running() { return running; }
+
+    /**
+     * @brief Number of samples acquired so far.
+     */
+    uint16_t get_count() { return count; }
+    const float *get_voltages() { return voltages; }
+    const float *get_currents() { return currents; }
+    const float *get_powers() { return powers; }
+
+  private:
+    RidenModbus &riden_modbus;
+    bool initialized = false;
+
+    uint16_t points = ACQUISITION_DEFAULT_POINTS;
+    uint32_t interval_ms = ACQUISITION_DEFAULT_INTERVAL_MS;
+
+    bool running = false;
+    unsigned long started_at = 0;
+    unsigned long last_due_at = 0; // When the last sample taken was due
+    uint16_t count = 0;
+    float voltages[ACQUISITION_MAX_POINTS] = {};
+    float currents[ACQUISITION_MAX_POINTS] = {};
+    float powers[ACQUISITION_MAX_POINTS] = {};
+};
+
+} // namespace RidenDongle
@@ -6,6 +6,9 @@
 
 #include <Arduino.h>
 
+#define ALLOW_LIST_LENGTH 128
+#define DEFAULT_RATE_BURST 20
+
 namespace RidenDongle
 {
 
@@ -32,10 +35,43 @@ class RidenConfig
     uint32_t get_uart_baudrate();
     void set_uart_baudrate(uint32_t baudrate);
 
+    /**
+     * @brief Clients allowed to connect to Modbus TCP and SCPI.
+     *
+     * Comma or space separated IP addresses, optionally with a
+     * prefix length, e.g. `192.168.1.0/24, 10.0.0.5`. Empty
+     * allows all clients.
+     */
+    String get_allow_list();
+    void set_allow_list(String allow_list);
+
+    /**
+     * @brief Maximum sustained requests/second per client, 0 for unlimited.
+     */
+    uint16_t get_rate_limit();
+    void set_rate_limit(uint16_t rate_limit);
+
+    /**
+     * @brief Number of requests a client may send in a burst.
+     */
+    uint16_t get_rate_burst();
+    void set_rate_burst(uint16_t rate_burst);
+
+    /**
+     * @brief Whether Modbus TCP writes to the calibration registers
+     * and the bootloader switch are rejected.
+     */
+    bool get_write_guard();
+    void set_write_guard(bool write_guard);
+
   private:
     String tz_name = "";
     bool config_portal_on_boot = false;
     uint32_t uart_baudrate = DEFAULT_UART_BAUDRATE;
+    String allow_list = "";
+    uint16_t rate_limit = 0;
+    uint16_t rate_burst = DEFAULT_RATE_BURST;
+    bool write_guard = true;
 };
 
 extern RidenConfig riden_config;
@@ -0,0 +1,175 @@
+// SPDX-FileCopyrightText: 2024 Peder Toftegaard Olsen
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <riden_access_control/riden_access_control.h>
+#include <riden_scpi/riden_scpi.h>
+
+#include <ESP8266WiFi.h>
+#include <list>
+
+#define DEFAULT_HISLIP_PORT 4880
+#define HISLIP_HEADER_LENGTH 16
+#define HISLIP_PROTOCOL_VERSION 0x0101 // 1.1
+#define HISLIP_VENDOR_ID 0x5244        // "RD"
+#define HISLIP_TIMEOUT_MS 1000
+#define HISLIP_MAX_CONTROL_PAYLOAD 64 // Longest payload of Initialize and asynchronous messages
+
+// AsyncLock control codes
+#define HISLIP_LOCK_RELEASE 0
+#define HISLIP_LOCK_REQUEST 1
+// AsyncLockResponse control codes
+#define HISLIP_LOCK_FAILURE 0
+#define HISLIP_LOCK_SUCCESS 1
+#define HISLIP_LOCK_ERROR 3
+
+namespace RidenDongle
+{
+
+/**
+ * @brief HiSLIP message types, IVI-6.1 section 2.5.
+ */
+enum class HislipMessageType : uint8_t {
+    Initialize = 0,
+    InitializeResponse = 1,
+    FatalError = 2,
+    Error = 3,
+    AsyncLock = 4,
+    AsyncLockResponse = 5,
+    Data = 6,
+    DataEnd = 7,
+    DeviceClearComplete = 8,
+    DeviceClearAcknowledge = 9,
+    AsyncRemoteLocalControl = 10,
+    AsyncRemoteLocalResponse = 11,
+    Trigger = 12,
+    Interrupted = 13,
+    AsyncInterrupted = 14,
+    AsyncMaximumMessageSize = 15,
+    AsyncMaximumMessageSizeResponse = 16,
+    AsyncInitialize = 17,
+    AsyncInitializeResponse = 18,
+    AsyncDeviceClear = 19,
+    AsyncServiceRequest = 20,
+    AsyncStatusQuery = 21,
+    AsyncStatusResponse = 22,
+    AsyncDeviceClearAcknowledge = 23,
+    AsyncLockInfo = 24,
+    AsyncLockInfoResponse = 25,
+};
+
+/**
+ * @brief Error codes sent with FatalError messages.
+ */
+enum class HislipFatalError : uint8_t {
+    Unidentified = 0,
+    PoorlyFormedHeader = 1,
+    ConnectionWithoutBothChannels = 2,
+    InvalidInitializationSequence = 3,
+    MaximumClientsExceeded = 4,
+};
+
+/**
+ * @brief Error codes sent with Error messages.
+ */
+enum class HislipError : uint8_t {
+    Unidentified = 0,
+    UnrecognizedMessageType = 1,
+    UnrecognizedControlCode = 2,
+    UnrecognizedVendorDefinedMessage = 3,
+    MessageTooLarge = 4,
+};
+
+struct HislipHeader {
+    HislipMessageType message_type;
+    uint8_t control_code;
+    uint32_t message_parameter;
+    uint64_t payload_length;
+};
+
+enum class HislipReceiveResult {
+    Pending,      // More bytes are needed
+    Complete,     // Header and payload have been read
+    PoorlyFormed, // The header is not a HiSLIP header
+    TooLarge,     // The payload does not fit in the buffer
+};
+
+/**
+ * @brief A message being read from a channel as its bytes arrive,
+ * see RidenHislip::receive().
+ */
+struct HislipReceiver {
+    HislipHeader header;
+    bool has_header = false;
+    size_t payload_read = 0;
+};
+
+/**
+ * @brief HiSLIP server for a single session.
+ *
+ * A session consists of a synchronous channel carrying the SCPI
+ * messages and an asynchronous channel carrying device clear, lock,
+ * status and service request messages, both on the same port.
+ * Messages are executed in synchronized mode by the shared RidenScpi
+ * parser.
+ */
+class RidenHislip
+{
+  public:
+    explicit RidenHislip(RidenScpi &ridenScpi, uint16_t port = DEFAULT_HISLIP_PORT)
+        : ridenScpi(ridenScpi), tcpServer(port) {}
+
+    bool begin();
+    bool loop();
+
+    uint16_t port();
+    const char *get_visa_resource();
+    std::list<IPAddress> get_connected_clients();
+    void disconnect_client(const IPAddress &ip);
+
+  private:
+    RidenScpi &ridenScpi;
+    bool initialized = false;
+
+    WiFiServer tcpServer;
+    WiFiClient pending_client; // Connected, but not yet initialized
+    unsigned long pending_since = 0;
+    HislipReceiver pending_receiver;
+    char pending_payload[HISLIP_MAX_CONTROL_PAYLOAD];
+    WiFiClient sync_client;
+    HislipReceiver sync_receiver;
+    WiFiClient async_client;
+    HislipReceiver async_receiver;
+    char async_payload[HISLIP_MAX_CONTROL_PAYLOAD];
+    ScpiSession session;
+
+    uint16_t session_id = 0;
+    uint32_t service_requests_seen = 0;
+
+    // Data messages are collected until DataEnd
+    char input[SCPI_INPUT_BUFFER_LENGTH];
+    size_t input_length = 0;
+
+    // Response collected while *OPC? or *WAI holds back the message
+    uint32_t response_message_id = 0;
+    String response;
+
+    bool read_header(WiFiClient &client, HislipHeader &header);
+    HislipReceiveResult receive(WiFiClient &client, HislipReceiver &receiver, char *buffer, size_t buffer_size);
+    void send_message(WiFiClient &client, HislipMessageType message_type, uint8_t control_code, uint32_t message_parameter,
+                      const void *payload = nullptr, size_t payload_length = 0);
+    void send_fatal_error(WiFiClient &client, HislipFatalError error);
+    void send_error(WiFiClient &client, HislipError error);
+    void send_receive_error(WiFiClient &client, HislipReceiveResult result);
+
+    void handle_pending_client();
+    void handle_sync_message();
+    void handle_async_message();
+    void execute_input(uint32_t message_id);
+    void send_response();
+    void stop_session();
+};
+
+} // namespace RidenDongle
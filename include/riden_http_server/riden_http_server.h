@@ -4,14 +4,19 @@
 
 #pragma once
 
+#include <riden_access_control/riden_access_control.h>
+#include <riden_hislip/riden_hislip.h>
 #include <riden_modbus/riden_modbus.h>
 #include <riden_modbus_bridge/riden_modbus_bridge.h>
+#include <riden_regulator/riden_regulator.h>
 #include <riden_scpi/riden_scpi.h>
 #include <vxi11_server/vxi_server.h>
 
 #include <ESP8266WebServer.h>
+#include <WebSockets4WebServer.h>
 
 #define HTTP_RAW_PORT 80
+#define WEBSOCKET_PATH "/scpi"
 
 namespace RidenDongle
 {
@@ -19,7 +24,7 @@ namespace RidenDongle
 class RidenHttpServer
 {
   public:
-    explicit RidenHttpServer(RidenModbus &modbus, RidenScpi &scpi, RidenModbusBridge &bridge, VXI_Server &vxi_server) : modbus(modbus), scpi(scpi), bridge(bridge), vxi_server(vxi_server), server(HTTP_RAW_PORT) {}
+    explicit RidenHttpServer(RidenModbus &modbus, RidenScpi &scpi, RidenModbusBridge &bridge, VXI_Server &vxi_server, RidenHislip &hislip, RidenRegulator &regulator) : modbus(modbus), scpi(scpi), bridge(bridge), vxi_server(vxi_server), hislip(hislip), regulator(regulator), server(HTTP_RAW_PORT) {}
     bool begin();
     void loop(void);
     uint16_t port();
@@ -29,7 +34,11 @@ class RidenHttpServer
     RidenScpi &scpi;
     RidenModbusBridge &bridge;
     VXI_Server &vxi_server;
+    RidenHislip &hislip;
+    RidenRegulator &regulator;
     ESP8266WebServer server;
+    WebSockets4WebServer websocket; // SCPI command lines on WEBSOCKET_PATH, one response per message
+    ScpiSession websocket_sessions[WEBSOCKETS_SERVER_CLIENT_MAX];
 
     void handle_root_get();
     void handle_psu_get();
@@ -46,6 +55,11 @@ class RidenHttpServer
     void handle_set_i();
     void handle_set_v();
     void handle_toggle_out();
+    void handle_regulation_get();
+    void handle_regulation_post();
+    void handle_performance_get();
+    void handle_performance_post();
+    void handle_websocket_event(uint8_t num, WStype_t type, uint8_t *payload, size_t length);
     
     void handle_modbus_qps();
     void send_redirect_root();
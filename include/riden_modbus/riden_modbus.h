@@ -13,6 +13,7 @@
 
 #define MODBUS_ADDRESS 1
 #define NUMBER_OF_PRESETS 9
+#define MODBUS_WRITE_QUEUE_LENGTH 16
 
 namespace RidenDongle
 {
@@ -80,6 +81,42 @@ struct AllValues {
     Preset presets[NUMBER_OF_PRESETS];
 };
 
+/**
+ * @brief Live readings, taken in a single transaction.
+ */
+struct Measurements {
+    double system_temperature_celsius;
+    double system_temperature_fahrenheit;
+    double voltage_set;
+    double current_set;
+    double voltage_out;
+    double current_out;
+    double power_out;
+    double voltage_in;
+    bool keypad_locked;
+    Protection protection;
+    OutputMode output_mode;
+    bool output_on;
+    uint16_t preset;
+    uint16_t current_range;
+};
+
+struct ModbusStatistics {
+    uint32_t transactions; // Requests sent to the power supply
+    uint32_t failures;     // Requests that could not be sent or completed
+    uint32_t timeouts;     // Requests that timed out waiting for a response
+    uint64_t wait_us;      // Time spent waiting for the power supply
+};
+
+/**
+ * @brief A register write waiting to be sent to the power supply.
+ */
+struct QueuedWrite {
+    uint16_t offset;
+    uint16_t values[2];
+    uint8_t numregs;
+};
+
 /**
  * @brief Serial modbus connection to Riden power supply.
  */
@@ -108,22 +145,68 @@ class RidenModbus
 
     bool get_current_set(double &current);
     bool set_current_set(const double current);
+    /**
+     * @brief Set voltage and current in a single transaction.
+     */
+    bool set_voltage_and_current_set(const double voltage, const double current);
 
     bool get_voltage_out(double &voltage);
     bool get_current_out(double &current);
 
     bool get_power_out(double &power);
 
+    /**
+     * @brief Read output voltage, current and power in a single transaction.
+     */
+    bool get_output_values(double &voltage, double &current, double &power);
+    /**
+     * @brief Read registers SystemTemperatureCelsius_Sign to CurrentRange in a single transaction.
+     */
+    bool get_measurements(Measurements &measurements);
+
     bool get_voltage_in(double &voltage_in);
 
     bool is_keypad_locked(bool &keypad);
 
     bool get_protection(Protection &protection);
+    /**
+     * @brief Read protection, output mode and output state in a single transaction.
+     */
+    bool get_status(Protection &protection, OutputMode &output_mode, bool &output_on);
     bool get_output_mode(OutputMode &output_mode);
 
     bool get_output_on(bool &result);
     bool set_output_on(const bool on);
 
+    /**
+     * @brief Queue writes to be sent from loop() without waiting for
+     * the power supply to respond.
+     *
+     * Queued writes are always sent before any subsequent synchronous
+     * read or write, so they take effect in order.
+     */
+    bool queue_voltage_set(const double voltage);
+    bool queue_current_set(const double current);
+    bool queue_output_on(const bool on);
+
+    /**
+     * @brief Whether queued writes have not yet completed.
+     */
+    bool has_queued_writes() { return write_queue_length > 0 || write_in_progress; }
+    /**
+     * @brief The register values written for a voltage or current.
+     */
+    uint16_t voltage_to_value(const double voltage);
+    uint16_t current_to_value(const double current);
+    /**
+     * @brief Send all queued writes and wait for them to complete.
+     */
+    void flush_write_queue();
+    /**
+     * @brief Whether a queued write failed since the last call.
+     */
+    bool take_write_failure();
+
     /**
      * @brief Set the preset
      *
@@ -175,7 +258,7 @@ class RidenModbus
     /**
      * @brief Store preset at `index`.
      *
-     * @param index One-based index, i.e. `1` refers to `M1`.
+     * @param index Preset index 0 (M0) to 9 (M9).
      * @return true On success.
      * @return false On failure.
      */
@@ -184,7 +267,7 @@ class RidenModbus
     /**
      * @brief Retrieve preset at `index`.
      *
-     * @param index One-based index, i.e. `1` refers to `M1`.
+     * @param index Preset index 0 (M0) to 9 (M9).
      * @return true On success.
      * @return false On failure.
      */
@@ -193,7 +276,7 @@ class RidenModbus
     /**
      * @brief Store preset voltage at `index`.
      *
-     * @param index One-based index, i.e. `1` refers to `M1`.
+     * @param index Preset index 0 (M0) to 9 (M9).
      * @return true On success.
      * @return false On failure.
      */
@@ -202,7 +285,7 @@ class RidenModbus
     /**
      * @brief Retrive preset voltage at `index`.
      *
-     * @param index One-based index, i.e. `1` refers to `M1`.
+     * @param index Preset index 0 (M0) to 9 (M9).
      * @return true On success.
      * @return false On failure.
      */
@@ -211,7 +294,7 @@ class RidenModbus
     /**
      * @brief Store preset current at `index`.
      *
-     * @param index One-based index, i.e. `1` refers to `M1`.
+     * @param index Preset index 0 (M0) to 9 (M9).
      * @return true On success.
      * @return false On failure.
      */
@@ -220,7 +303,7 @@ class RidenModbus
     /**
      * @brief Retrieve preset current at `index`.
      *
-     * @param index One-based index, i.e. `1` refers to `M1`.
+     * @param index Preset index 0 (M0) to 9 (M9).
      * @return true On success.
      * @return false On failure.
      */
@@ -229,7 +312,7 @@ class RidenModbus
     /**
      * @brief Store preset OVP at `index`.
      *
-     * @param index One-based index, i.e. `1` refers to `M1`.
+     * @param index Preset index 0 (M0) to 9 (M9).
      * @return true On success.
      * @return false On failure.
      */
@@ -238,7 +321,7 @@ class RidenModbus
     /**
      * @brief Retrieve preset OVP at `index`.
      *
-     * @param index One-based index, i.e. `1` refers to `M1`.
+     * @param index Preset index 0 (M0) to 9 (M9).
      * @return true On success.
      * @return false On failure.
      */
@@ -247,7 +330,7 @@ class RidenModbus
     /**
      * @brief Store preset OCP at `index`.
      *
-     * @param index One-based index, i.e. `1` refers to `M1`.
+     * @param index Preset index 0 (M0) to 9 (M9).
      * @return true On success.
      * @return false On failure.
      */
@@ -256,7 +339,7 @@ class RidenModbus
     /**
      * @brief Retrieve preset OCP at `index`.
      *
-     * @param index One-based index, i.e. `1` refers to `M1`.
+     * @param index Preset index 0 (M0) to 9 (M9).
      * @return true On success.
      * @return false On failure.
      */
@@ -280,6 +363,8 @@ class RidenModbus
     double get_max_voltage() { return v_max; }
     double get_max_current() { return i_max; }
 
+    const ModbusStatistics &get_statistics() { return statistics; }
+
   private:
     ModbusRTU modbus;
     unsigned long timeout = 500; // milliseconds
@@ -293,6 +378,18 @@ class RidenModbus
     double v_max = 61.0;
     double i_max = 30.1;
 
+    ModbusStatistics statistics = {};
+
+    QueuedWrite write_queue[MODBUS_WRITE_QUEUE_LENGTH];
+    uint8_t write_queue_start = 0;
+    uint8_t write_queue_length = 0;
+    bool write_in_progress = false;
+    bool write_failed = false;
+
+    bool queue_write(const Register reg, const uint16_t *values, const uint8_t numregs);
+    bool send_queued_write();
+    void complete_queued_write();
+
     /**
      *  Wait until no transaction is active or timeout.
      *
@@ -312,8 +409,6 @@ class RidenModbus
     double value_to_voltage_in(const uint16_t value);
     double value_to_current(const uint16_t value);
     double values_to_power(const uint16_t *values);
-    uint16_t voltage_to_value(const double voltage);
-    uint16_t current_to_value(const double current);
     double values_to_temperature(const uint16_t *values);
     double values_to_ah(const uint16_t *values);
     double values_to_wh(const uint16_t *values);
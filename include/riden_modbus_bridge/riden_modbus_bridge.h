@@ -4,14 +4,36 @@
 
 #pragma once
 
+#include "riden_modbus_bridge_registers.h"
+#include <riden_access_control/riden_access_control.h>
 #include <riden_modbus/riden_modbus.h>
+#include <riden_telemetry/riden_telemetry.h>
 
 #include <ModbusTCP.h>
 #include <list>
 
+// Requests queued for the power supply, shared by all clients
+#define MODBUS_BRIDGE_QUEUE_SIZE 8
+// Outstanding requests accepted from a single client IP-address.
+// modbus-esp8266 identifies the sender of a request only by its
+// IP-address, and rawResponce() routes the response by IP-address,
+// so connections from the same host, or hosts behind the same NAT,
+// cannot be told apart and share this window.
+#define MODBUS_BRIDGE_MAX_IN_FLIGHT 4
+#define MODBUS_BRIDGE_MAX_PDU_LENGTH 253
+#define MODBUS_BRIDGE_MBAP_LENGTH 7
+
 namespace RidenDongle
 {
 
+struct BridgeRequest {
+    uint32_t ip;
+    uint16_t transaction_id;
+    uint8_t slave_id;
+    uint8_t len;
+    uint8_t data[MODBUS_BRIDGE_MAX_PDU_LENGTH];
+};
+
 class RidenModbusTCP : public ModbusTCP
 {
   public:
@@ -26,15 +48,24 @@ class RidenModbusTCP : public ModbusTCP
      * @param ip IP-address of client to disconnect.
      */
     void disconnect_client(const IPAddress &ip);
+
+    /**
+     * @brief Whether any client has sent data that has not been processed yet.
+     */
+    bool has_pending_data();
 };
 
 /**
  * @brief Modbus TCP bridge.
+ *
+ * Requests for the power supply registers are forwarded to
+ * the power supply, while requests for the VirtualRegister
+ * block are served by the dongle.
  */
 class RidenModbusBridge
 {
   public:
-    explicit RidenModbusBridge(RidenModbus &riden_modbus) : riden_modbus(riden_modbus){};
+    explicit RidenModbusBridge(RidenModbus &riden_modbus, RidenTelemetry &riden_telemetry) : riden_modbus(riden_modbus), riden_telemetry(riden_telemetry){};
     bool begin();
     bool loop();
 
@@ -42,18 +73,41 @@ class RidenModbusBridge
     std::list<IPAddress> get_connected_clients();
     void disconnect_client(const IPAddress &ip);
 
+    bool modbus_tcp_connect_callback(IPAddress ip);
     Modbus::ResultCode modbus_tcp_raw_callback(uint8_t *data, uint8_t len, void *custom_data);
     Modbus::ResultCode modbus_rtu_raw_callback(uint8_t *data, uint8_t len, void *custom);
 
   private:
     RidenModbus &riden_modbus;
+    RidenTelemetry &riden_telemetry;
     RidenModbusTCP modbus_tcp;
     bool initialized = false;
 
+    // Requests waiting to be forwarded to the power supply
+    BridgeRequest queue[MODBUS_BRIDGE_QUEUE_SIZE];
+    uint8_t queue_head = 0;
+    uint8_t queue_length = 0;
+
     // State of any currently running modbus command
+    bool awaiting_response = false;
+    unsigned long request_started_at = 0;
     uint16_t transaction_id = 0; // ModbusTCP transaction
     uint8_t slave_id = 0;        // Request slave
+    uint8_t function_code = 0;   // Request function code
     uint32_t ip = 0;
+
+    bool enqueue(const uint8_t *data, uint8_t len, const Modbus::frame_arg_t *source);
+    uint8_t count_in_flight(uint32_t ip);
+    void start_next_request();
+
+    Modbus::ResultCode check_write_guard(const uint8_t *data, uint8_t len);
+
+    bool is_virtual_request(const uint8_t *data, uint8_t len);
+    void handle_virtual_request(const uint8_t *data, uint8_t len, const Modbus::frame_arg_t *source);
+    void get_virtual_registers(uint16_t *values);
+
+    void send_response(uint32_t ip, uint16_t transaction_id, uint8_t slave_id, uint8_t *data, uint8_t len);
+    void send_error_response(uint32_t ip, uint16_t transaction_id, uint8_t slave_id, uint8_t function_code, Modbus::ResultCode code);
 };
 
 } // namespace RidenDongle
@@ -0,0 +1,50 @@
+// SPDX-FileCopyrightText: 2024 Peder Toftegaard Olsen
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stdint.h>
+
+namespace RidenDongle
+{
+
+// Registers served by the dongle itself rather than by the power supply.
+// All values occupy two registers, most significant word first. Values
+// marked (float) are IEEE 754 float32, the rest are unsigned 32 bit integers.
+enum class VirtualRegister {
+    FIRST = 1000,
+    VoltageOut = 1000,     // (float) V
+    CurrentOut = 1002,     // (float) A
+    PowerOut = 1004,       // (float) W
+    Energy = 1006,         // (float) Wh integrated by the dongle
+    VoltageMin = 1008,     // (float) V, last window
+    VoltageMax = 1010,     // (float) V, last window
+    VoltageAvg = 1012,     // (float) V, last window
+    CurrentMin = 1014,     // (float) A, last window
+    CurrentMax = 1016,     // (float) A, last window
+    CurrentAvg = 1018,     // (float) A, last window
+    PowerMin = 1020,       // (float) W, last window
+    PowerMax = 1022,       // (float) W, last window
+    PowerAvg = 1024,       // (float) W, last window
+    WindowSamples = 1026,  // Number of samples in the last window
+    SampleAge = 1028,      // Age of VoltageOut/CurrentOut/PowerOut in ms
+    Transactions = 1030,   // Modbus RTU transactions
+    Failures = 1032,       // Modbus RTU failed transactions
+    Timeouts = 1034,       // Modbus RTU timed out transactions
+    Uptime = 1036,         // Dongle uptime in seconds
+    END = 1038,
+};
+
+/**
+ * @brief Convert VirtualRegister to uint16_t.
+ *
+ * @param reg The register.
+ * @return The uint16_t.
+ */
+constexpr uint16_t operator+(VirtualRegister reg) noexcept
+{
+    return static_cast<uint16_t>(reg);
+}
+
+} // namespace RidenDongle
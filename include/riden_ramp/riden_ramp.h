@@ -0,0 +1,72 @@
+// SPDX-FileCopyrightText: 2024 Peder Toftegaard Olsen
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <riden_modbus/riden_modbus.h>
+
+namespace RidenDongle
+{
+
+struct Ramp {
+    bool active;
+    double from;
+    double to;
+    double slew; // Units/second
+    unsigned long started_at;
+    uint16_t value; // Register value last written
+};
+
+/**
+ * @brief Ramps voltage and current to a new level at a fixed slew rate.
+ *
+ * While ramping, the set value is queued whenever the register
+ * value changes and no other write is waiting, so slow ramps do not
+ * occupy the Modbus connection with identical writes.
+ */
+class RidenRamp
+{
+  public:
+    explicit RidenRamp(RidenModbus &riden_modbus) : riden_modbus(riden_modbus) {}
+    bool begin();
+    bool loop();
+
+    /**
+     * @brief Voltage slew rate in V/s, 0 to change the voltage immediately.
+     */
+    void set_voltage_slew(double slew) { voltage_slew = slew; }
+    double get_voltage_slew() { return voltage_slew; }
+    /**
+     * @brief Current slew rate in A/s, 0 to change the current immediately.
+     */
+    void set_current_slew(double slew) { current_slew = slew; }
+    double get_current_slew() { return current_slew; }
+
+    /**
+     * @brief Set the voltage, ramping if a slew rate is set.
+     */
+    bool set_voltage(double voltage);
+    /**
+     * @brief Set the current, ramping if a slew rate is set.
+     */
+    bool set_current(double current);
+
+    bool is_voltage_ramping() { return voltage_ramp.active; }
+    double get_voltage_target() { return voltage_ramp.to; }
+    bool is_current_ramping() { return current_ramp.active; }
+    double get_current_target() { return current_ramp.to; }
+
+    void abort();
+
+  private:
+    RidenModbus &riden_modbus;
+    bool initialized = false;
+
+    double voltage_slew = 0;
+    double current_slew = 0;
+    Ramp voltage_ramp = {};
+    Ramp current_ramp = {};
+};
+
+} // namespace RidenDongle
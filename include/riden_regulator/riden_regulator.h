@@ -0,0 +1,91 @@
+// SPDX-FileCopyrightText: 2024 Peder Toftegaard Olsen
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <riden_modbus/riden_modbus.h>
+
+// Interval over which the achieved update rate is measured
+#define REGULATOR_RATE_INTERVAL_MS 1000
+// Below this output current the load cannot be estimated
+#define REGULATOR_MIN_CURRENT 0.005
+// Fraction of the voltage error corrected on each update
+#define REGULATOR_GAIN 0.5
+
+namespace RidenDongle
+{
+
+enum class RegulationMode {
+    Off = 0,
+    ConstantPower = 1,
+    ConstantResistance = 2,
+};
+
+/**
+ * @brief Closed loop regulation of the output voltage.
+ *
+ * In constant power mode the voltage is adjusted to deliver the
+ * target power into the present load. In constant resistance mode
+ * the power supply emulates a source with the target internal
+ * resistance, i.e. the voltage drops by current times resistance
+ * from the voltage set when regulation started.
+ *
+ * Every update reads the output values, and queues a voltage write
+ * only when the register value changes, so the achieved update rate
+ * depends on the UART baud rate.
+ *
+ * While regulating, the regulator owns the voltage set point, so
+ * other writers of the voltage must be kept off.
+ */
+class RidenRegulator
+{
+  public:
+    explicit RidenRegulator(RidenModbus &riden_modbus) : riden_modbus(riden_modbus) {}
+    bool begin();
+    bool loop();
+
+    /**
+     * @brief Start or stop regulation.
+     *
+     * @return false if the present voltage could not be read.
+     */
+    bool set_mode(RegulationMode mode);
+    RegulationMode get_mode() { return mode; }
+
+    void set_power(double power) { target_power = power; }
+    double get_power() { return target_power; }
+    void set_resistance(double resistance) { target_resistance = resistance; }
+    double get_resistance() { return target_resistance; }
+    /**
+     * @brief Voltage at zero current in constant resistance mode.
+     */
+    void set_open_circuit_voltage(double voltage) { open_circuit_voltage = voltage; }
+
+    /**
+     * @brief Updates per second achieved during the last interval.
+     */
+    double get_update_rate() { return update_rate; }
+
+  private:
+    RidenModbus &riden_modbus;
+    bool initialized = false;
+
+    RegulationMode mode = RegulationMode::Off;
+    double target_power = 0;
+    double target_resistance = 0;
+
+    double voltage_set = 0;          // Last voltage written
+    uint16_t voltage_set_value = 0;  // Register value of voltage_set
+    double open_circuit_voltage = 0; // Voltage set when constant resistance started, or set since
+    double current_set = 0;          // Current limit, read again every rate interval
+    bool current_set_stale = true;
+
+    uint32_t updates = 0;
+    unsigned long rate_interval_started_at = 0;
+    double update_rate = 0;
+
+    bool update();
+};
+
+} // namespace RidenDongle
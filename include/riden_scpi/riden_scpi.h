@@ -4,24 +4,132 @@
 
 #pragma once
 
+#include <riden_access_control/riden_access_control.h>
+#include <riden_acquisition/riden_acquisition.h>
 #include <riden_modbus/riden_modbus.h>
+#include <riden_ramp/riden_ramp.h>
+#include <riden_regulator/riden_regulator.h>
+#include <riden_sequencer/riden_sequencer.h>
+#include <riden_state_store/riden_state_store.h>
+#include <riden_telemetry/riden_telemetry.h>
+#include <riden_trigger/riden_trigger.h>
 
 #include <ESP8266WiFi.h>
 #include <SCPI_Parser.h>
 #include <list>
 
 #define WRITE_BUFFER_LENGTH (256)
+#define EXTERNAL_OUTPUT_MAX_LENGTH 8192 // Largest response held for the VXI server
 #define SCPI_INPUT_BUFFER_LENGTH 256
+#define SCPI_MAX_CLIENTS 4
 #define SCPI_ERROR_QUEUE_SIZE 17
 #define DEFAULT_SCPI_PORT 5025
+#define SCPI_DISPATCH_BUCKETS 64
+#define SCPI_MAX_MACROS 8
+#define SCPI_MACRO_LABEL_LENGTH 13 // Including the terminating zero
+#define SCPI_MACRO_BODY_LENGTH 128
+#define SCPI_STATUS_INTERVAL_MS 250
+#define SCPI_DEFERRED_INPUT_LENGTH 512 // Input held back by *OPC? or *WAI
+
+// STATus:QUEStionable bits driven by the power supply
+#define QUES_OVP_TRIPPED (1 << 0)
+#define QUES_OCP_TRIPPED (1 << 1)
+// STATus:OPERation bits driven by the power supply
+#define OPER_CONSTANT_VOLTAGE (1 << 8)
+#define OPER_CONSTANT_CURRENT (1 << 9)
+#define OPER_OUTPUT_OFF (1 << 10)
 
 namespace RidenDongle
 {
 
+/**
+ * @brief Encoding of bulk query results, selected with FORMat[:DATA].
+ */
+enum class DataFormat {
+    ASCII = 0,   // Comma-separated list
+    REAL32 = 1,  // Binary block of little-endian float32
+    INTEGER = 2, // Binary block of little-endian int32 in milli-units
+};
+
+/**
+ * @brief A connection sending commands, which may hold SYSTem:LOCK.
+ */
+struct ScpiSession {
+    IPAddress ip;
+    // Input held back by *OPC? or *WAI until the pending operations
+    // complete, starting with the *OPC? or *WAI itself
+    String deferred;
+
+    bool is_waiting() { return deferred.length() > 0; }
+};
+
+/**
+ * @brief A raw socket client and the input not yet executed.
+ */
+struct ScpiClient : ScpiSession {
+    WiFiClient client;
+    char input_buffer[SCPI_INPUT_BUFFER_LENGTH];
+    size_t input_length = 0;
+};
+
+/**
+ * @brief Receives the response to a line passed to RidenScpi::execute().
+ */
+class ScpiOutput
+{
+  public:
+    virtual ~ScpiOutput() {}
+    virtual size_t write(const char *data, size_t len) = 0;
+    virtual void flush() {}
+};
+
+/**
+ * @brief Collects a response to send as a single message.
+ */
+class ScpiBufferedOutput : public ScpiOutput
+{
+  public:
+    size_t write(const char *data, size_t len) override;
+
+    String text;
+};
+
+/**
+ * @brief A macro defined with *DMC.
+ */
+struct ScpiMacro {
+    char label[SCPI_MACRO_LABEL_LENGTH] = {}; // Empty when unused
+    char body[SCPI_MACRO_BODY_LENGTH];
+    size_t body_length = 0;
+};
+
+/**
+ * @brief Time spent on a command, reported by SYSTem:PERFormance?
+ */
+struct ScpiCommandProfile {
+    uint32_t calls = 0;
+    uint64_t parse_us = 0;  // From the start of the line or the previous command
+    uint64_t modbus_us = 0; // Waiting for the power supply
+    uint64_t total_us = 0;  // Parsing and execution
+};
+
+/**
+ * @brief The commands whose header starts with a given mnemonic.
+ *
+ * The key holds the first three characters of the mnemonic in
+ * upper case, which are shared by its short and long form.
+ */
+struct ScpiDispatchGroup {
+    uint32_t key = 0; // 0 for an unused bucket
+    uint16_t offset = 0;
+    uint16_t length = 0;
+};
+
 class RidenScpi
 {
   public:
-    explicit RidenScpi(RidenModbus &ridenModbus, uint16_t port = DEFAULT_SCPI_PORT) : ridenModbus(ridenModbus), tcpServer(port) {}
+    explicit RidenScpi(RidenModbus &ridenModbus, RidenTelemetry &ridenTelemetry, RidenAcquisition &ridenAcquisition, RidenSequencer &ridenSequencer, RidenRamp &ridenRamp, RidenRegulator &ridenRegulator, RidenTrigger &ridenTrigger, uint16_t port = DEFAULT_SCPI_PORT)
+        : ridenModbus(ridenModbus), ridenTelemetry(ridenTelemetry), ridenAcquisition(ridenAcquisition), ridenSequencer(ridenSequencer), ridenRamp(ridenRamp), ridenRegulator(ridenRegulator), ridenTrigger(ridenTrigger), state_store(ridenModbus, ridenRamp, ridenSequencer), tcpServer(port) {}
 
     bool begin();
     bool loop();
@@ -33,16 +141,48 @@ class RidenScpi
 
     // some inferface functions to handle commands to the SCPI parser from an outside source
     // TODO: The SCPI parser should be externalised into another class and instance
-    bool claim_external_control() { 
-      external_control = true; 
-      return true; // I always gain priority
+    bool claim_external_control()
+    {
+        if (lock_owner != nullptr) {
+            // The client holding SYSTem:LOCK keeps the parser
+            return false;
+        }
+        external_control = true;
+        return true;
+    }
+    void release_external_control()
+    {
+        external_control = false;
+        end_session(vxi_session);
+        clear_external_output();
     }
-    void release_external_control() { external_control = false; }
+    bool is_external_control_waiting() { return vxi_session.is_waiting(); }
     void write(const char *data, size_t len);
-    scpi_result_t read(char *data, size_t *len, size_t max_len);
+    scpi_result_t read(char *data, size_t *len, size_t max_len, bool *end);
+
+    void execute(ScpiSession &session, const char *data, size_t len, ScpiOutput &output);
+    bool resume(ScpiSession &session, ScpiOutput &output);
+    void end_session(ScpiSession &session);
+    bool request_lock(ScpiSession &session);
+    bool release_lock(ScpiSession &session);
+    bool is_locked() { return lock_owner != nullptr; }
+    uint8_t read_status_byte();
+    uint32_t get_service_request_count() { return service_request_count; }
+
+    uint16_t get_command_count() { return command_count; }
+    const char *get_command_pattern(uint16_t index) { return scpi_commands[index].pattern; }
+    const ScpiCommandProfile *get_command_profiles() { return command_profiles; }
+    void reset_command_profiles();
 
   private:
     RidenModbus &ridenModbus;
+    RidenTelemetry &ridenTelemetry;
+    RidenAcquisition &ridenAcquisition;
+    RidenSequencer &ridenSequencer;
+    RidenRamp &ridenRamp;
+    RidenRegulator &ridenRegulator;
+    RidenTrigger &ridenTrigger;
+    RidenStateStore state_store;
 
     bool initialized = false;
     const char *idn1 = "Riden"; // <company name>
@@ -54,9 +194,17 @@ class RidenScpi
     char scpi_input_buffer[SCPI_INPUT_BUFFER_LENGTH] = {};
     scpi_error_t scpi_error_queue_data[SCPI_ERROR_QUEUE_SIZE];
 
+    // Output to the raw socket client is sent in chunks of this buffer
     char write_buffer[WRITE_BUFFER_LENGTH] = {};
     size_t write_buffer_length = 0;
 
+    // Output waiting to be read by the VXI server, allocated while
+    // a response is pending
+    char *external_output = nullptr;
+    size_t external_output_length = 0;
+    size_t external_output_capacity = 0;
+    size_t external_output_position = 0;
+
     // external_control is used to indicate that the SCPI parser is handling a command from outside of the socket server
     // See claim_external_control() and release_external_control()
     bool external_control = false;
@@ -66,9 +214,65 @@ class RidenScpi
     static scpi_interface_t scpi_interface;
 
     WiFiServer tcpServer;
-    WiFiClient client;
+    ScpiClient clients[SCPI_MAX_CLIENTS];
+    uint8_t next_client = 0;
+    ScpiClient *current_client = nullptr;   // Raw socket client whose command is being executed
+    ScpiOutput *current_output = nullptr;   // Receives output instead of current_client, see execute()
+    ScpiSession *current_session = nullptr; // Session whose command is being executed, if any
+    ScpiSession *lock_owner = nullptr;      // Session holding SYSTem:LOCK
+    ScpiSession vxi_session;                // Commands from the VXI server, see write()
+
+    // Set by *OPC? or *WAI when the input from that command on must
+    // wait for the pending operations, see parse()
+    const char *deferred_at = nullptr;
+    String deferred_input;
+
+    // Command table with every callback wrapped by ProfileCommand()
+    scpi_command_t *profiled_commands = nullptr;
+    ScpiCommandProfile *command_profiles = nullptr;
+    uint16_t command_count = 0;
+    unsigned long parse_mark_us = 0; // micros() when parsing of the next command started
+
+    // Command table grouped by header, see build_dispatch_index()
+    ScpiDispatchGroup dispatch_index[SCPI_DISPATCH_BUCKETS];
+    scpi_command_t *dispatch_commands = nullptr;
+
+    DataFormat data_format = DataFormat::ASCII;
 
-    void reset_buffers();
+    ScpiMacro macros[SCPI_MAX_MACROS];
+    bool macros_enabled = true;
+
+    // *OPC was received while operations were pending
+    bool operation_complete_pending = false;
+
+    // Power supply status mirrored into the SCPI status registers
+    unsigned long status_updated_at = 0;
+    uint32_t service_request_count = 0; // SRQs raised, compared by each server with the count it has seen
+
+    // Result of the last MEASure:ALL?
+    Measurements last_measurements = {};
+    bool has_measurements = false;
+
+    void accept_client(WiFiClient &new_client);
+    void stop_client(ScpiClient &scpi_client);
+    void read_input(ScpiClient &scpi_client);
+    bool execute_next_line(ScpiClient &scpi_client);
+    void send_write_buffer();
+    bool append_external_output(const char *data, size_t len);
+    void clear_external_output();
+
+    void build_profiled_commands();
+    const scpi_command_t *get_commands();
+    bool build_dispatch_index();
+    ScpiDispatchGroup *find_dispatch_group(uint32_t key, bool insert);
+    void select_commands(const char *data, size_t len);
+    void run_line(ScpiSession &session, char *data, size_t len);
+    void resume_line(ScpiSession &session);
+    void parse(char *data, size_t len);
+    bool defer_until_complete(scpi_t *context);
+    ScpiMacro *find_macro(const char *label, size_t len);
+    bool update_status();
+    bool operations_pending();
 
     // SCPI Functions and Commands
     // ===========================
@@ -81,8 +285,26 @@ class RidenScpi
     static int SCPI_Error(scpi_t *context, int_fast16_t err);
     static scpi_result_t SCPI_Control(scpi_t *context, scpi_ctrl_name_t ctrl, scpi_reg_val_t val);
     static scpi_result_t SCPI_Reset(scpi_t *context);
+    static scpi_result_t ProfileCommand(scpi_t *context);
 
+    static scpi_result_t Opc(scpi_t *context);
+    static scpi_result_t OpcQ(scpi_t *context);
+    static scpi_result_t Wai(scpi_t *context);
+    static scpi_result_t Sav(scpi_t *context);
     static scpi_result_t Rcl(scpi_t *context);
+    static scpi_result_t Dmc(scpi_t *context);
+    static scpi_result_t GmcQ(scpi_t *context);
+    static scpi_result_t LmcQ(scpi_t *context);
+    static scpi_result_t Pmc(scpi_t *context);
+    static scpi_result_t Rmc(scpi_t *context);
+    static scpi_result_t Emc(scpi_t *context);
+    static scpi_result_t EmcQ(scpi_t *context);
+    static scpi_result_t Trg(scpi_t *context);
+    static scpi_result_t StbQ(scpi_t *context);
+    static scpi_result_t StatusOperationEventQ(scpi_t *context);
+    static scpi_result_t StatusOperationConditionQ(scpi_t *context);
+    static scpi_result_t StatusQuestionableEventQ(scpi_t *context);
+    static scpi_result_t StatusQuestionableConditionQ(scpi_t *context);
 
     static scpi_result_t DisplayBrightness(scpi_t *context);
     static scpi_result_t DisplayBrightnessQ(scpi_t *context);
@@ -96,14 +318,38 @@ class RidenScpi
 
     static scpi_result_t SourceVoltage(scpi_t *context);
     static scpi_result_t SourceVoltageQ(scpi_t *context);
+    static scpi_result_t SourceVoltageProtection(scpi_t *context);
+    static scpi_result_t SourceVoltageProtectionQ(scpi_t *context);
     static scpi_result_t SourceVoltageProtectionTrippedQ(scpi_t *context);
     static scpi_result_t SourceCurrent(scpi_t *context);
     static scpi_result_t SourceCurrentQ(scpi_t *context);
+    static scpi_result_t SourceCurrentProtection(scpi_t *context);
+    static scpi_result_t SourceCurrentProtectionQ(scpi_t *context);
     static scpi_result_t SourceCurrentProtectionTrippedQ(scpi_t *context);
     static scpi_result_t SourceVoltageLimit(scpi_t *context);
     static scpi_result_t SourceVoltageLimitQ(scpi_t *context);
     static scpi_result_t SourceCurrentLimit(scpi_t *context);
     static scpi_result_t SourceCurrentLimitQ(scpi_t *context);
+    static scpi_result_t SourceVoltageSlew(scpi_t *context);
+    static scpi_result_t SourceVoltageSlewQ(scpi_t *context);
+    static scpi_result_t SourceCurrentSlew(scpi_t *context);
+    static scpi_result_t SourceCurrentSlewQ(scpi_t *context);
+    static scpi_result_t SourceVoltageTriggered(scpi_t *context);
+    static scpi_result_t SourceVoltageTriggeredQ(scpi_t *context);
+    static scpi_result_t SourceCurrentTriggered(scpi_t *context);
+    static scpi_result_t SourceCurrentTriggeredQ(scpi_t *context);
+    static scpi_result_t TriggerSequenceSource(scpi_t *context);
+    static scpi_result_t TriggerSequenceSourceQ(scpi_t *context);
+    static scpi_result_t TriggerSequenceTimer(scpi_t *context);
+    static scpi_result_t TriggerSequenceTimerQ(scpi_t *context);
+
+    static scpi_result_t SourcePower(scpi_t *context);
+    static scpi_result_t SourcePowerQ(scpi_t *context);
+    static scpi_result_t SourceResistance(scpi_t *context);
+    static scpi_result_t SourceResistanceQ(scpi_t *context);
+    static scpi_result_t SourceFunction(scpi_t *context);
+    static scpi_result_t SourceFunctionQ(scpi_t *context);
+    static scpi_result_t SourceRegulationRateQ(scpi_t *context);
 
     static scpi_result_t OutputState(scpi_t *context);
     static scpi_result_t OutputStateQ(scpi_t *context);
@@ -113,9 +359,49 @@ class RidenScpi
     static scpi_result_t MeasureCurrentQ(scpi_t *context);
     static scpi_result_t MeasurePowerQ(scpi_t *context);
     static scpi_result_t MeasureTemperatureQ(scpi_t *context);
+    static scpi_result_t MeasureAllQ(scpi_t *context);
+    static scpi_result_t FetchAllQ(scpi_t *context);
+    static scpi_result_t FetchVoltageQ(scpi_t *context);
+    static scpi_result_t FetchCurrentQ(scpi_t *context);
+    static scpi_result_t FetchPowerQ(scpi_t *context);
+
+    static scpi_result_t SenseSweepPoints(scpi_t *context);
+    static scpi_result_t SenseSweepPointsQ(scpi_t *context);
+    static scpi_result_t SenseSweepTimeInterval(scpi_t *context);
+    static scpi_result_t SenseSweepTimeIntervalQ(scpi_t *context);
+    static scpi_result_t Initiate(scpi_t *context);
+    static scpi_result_t Abort(scpi_t *context);
+    static scpi_result_t FetchArrayVoltageQ(scpi_t *context);
+    static scpi_result_t FetchArrayCurrentQ(scpi_t *context);
+    static scpi_result_t FetchArrayPowerQ(scpi_t *context);
+    static scpi_result_t TraceDataQ(scpi_t *context);
+    static scpi_result_t TracePointsActualQ(scpi_t *context);
+
+    static scpi_result_t FormatData(scpi_t *context);
+    static scpi_result_t FormatDataQ(scpi_t *context);
+
+    static scpi_result_t SourceListVoltage(scpi_t *context);
+    static scpi_result_t SourceListVoltageQ(scpi_t *context);
+    static scpi_result_t SourceListCurrent(scpi_t *context);
+    static scpi_result_t SourceListCurrentQ(scpi_t *context);
+    static scpi_result_t SourceListDwell(scpi_t *context);
+    static scpi_result_t SourceListDwellQ(scpi_t *context);
+    static scpi_result_t SourceListCount(scpi_t *context);
+    static scpi_result_t SourceListCountQ(scpi_t *context);
+    static scpi_result_t SourceVoltageMode(scpi_t *context);
+    static scpi_result_t SourceVoltageModeQ(scpi_t *context);
+    static scpi_result_t SourceCurrentMode(scpi_t *context);
+    static scpi_result_t SourceCurrentModeQ(scpi_t *context);
 
     static scpi_result_t SystemBeeperState(scpi_t *context);
     static scpi_result_t SystemBeeperStateQ(scpi_t *context);
+
+    static scpi_result_t SystemLockRequestQ(scpi_t *context);
+    static scpi_result_t SystemLockRelease(scpi_t *context);
+    static scpi_result_t SystemLockOwnerQ(scpi_t *context);
+
+    static scpi_result_t SystemPerformanceQ(scpi_t *context);
+    static scpi_result_t SystemPerformanceReset(scpi_t *context);
 };
 
 } // namespace RidenDongle
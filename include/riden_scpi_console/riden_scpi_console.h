@@ -0,0 +1,88 @@
+// SPDX-FileCopyrightText: 2024 Peder Toftegaard Olsen
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <riden_access_control/riden_access_control.h>
+#include <riden_scpi/riden_scpi.h>
+
+#include <ESP8266WiFi.h>
+
+#define DEFAULT_SCPI_CONSOLE_PORT 5024
+#define SCPI_CONSOLE_HISTORY_LENGTH 8
+#define SCPI_CONSOLE_PROMPT "SCPI> "
+
+namespace RidenDongle
+{
+
+/**
+ * @brief Sends command output to the console client.
+ */
+class ScpiConsoleOutput : public ScpiOutput
+{
+  public:
+    explicit ScpiConsoleOutput(WiFiClient &client) : client(client) {}
+    size_t write(const char *data, size_t len) override;
+
+  private:
+    WiFiClient &client;
+};
+
+/**
+ * @brief Interactive SCPI console for telnet clients.
+ *
+ * The console echoes input, shows a prompt and keeps a history
+ * of the previous lines, recalled with the up and down arrow keys.
+ * Commands are executed by the shared RidenScpi parser.
+ */
+class RidenScpiConsole
+{
+  public:
+    explicit RidenScpiConsole(RidenScpi &ridenScpi, uint16_t port = DEFAULT_SCPI_CONSOLE_PORT)
+        : ridenScpi(ridenScpi), tcpServer(port) {}
+
+    bool begin();
+    bool loop();
+
+    uint16_t port();
+
+  private:
+    RidenScpi &ridenScpi;
+    bool initialized = false;
+
+    WiFiServer tcpServer;
+    WiFiClient client;
+    ScpiSession session;
+
+    char line[SCPI_INPUT_BUFFER_LENGTH] = {};
+    size_t line_length = 0;
+
+    char history[SCPI_CONSOLE_HISTORY_LENGTH][SCPI_INPUT_BUFFER_LENGTH] = {};
+    uint8_t history_length = 0;
+    uint8_t history_start = 0;    // Oldest line
+    uint8_t history_position = 0; // Line being recalled, history_length when editing a new line
+
+    // Telnet commands and escape sequences are consumed a byte at a time
+    enum class InputState {
+        Normal,
+        Iac,           // Received IAC
+        IacOption,     // Received IAC WILL/WONT/DO/DONT
+        Subnegotiation,
+        SubnegotiationIac,
+        Escape,        // Received ESC
+        EscapeSequence // Received ESC [
+    };
+    InputState input_state = InputState::Normal;
+    bool skip_newline = false; // Ignore LF or NUL following CR
+
+    void accept_client(WiFiClient &new_client);
+    void handle_input(uint8_t c);
+    void execute_line();
+    void add_to_history();
+    void recall_history(uint8_t position);
+    void replace_line(const char *text, size_t len);
+    void send_prompt();
+};
+
+} // namespace RidenDongle
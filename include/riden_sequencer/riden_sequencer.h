@@ -0,0 +1,85 @@
+// SPDX-FileCopyrightText: 2024 Peder Toftegaard Olsen
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <riden_modbus/riden_modbus.h>
+
+#define SEQUENCER_MAX_POINTS 32
+
+namespace RidenDongle
+{
+
+/**
+ * @brief Steps the power supply through lists of voltages and currents.
+ *
+ * Each step is held for its dwell time, timed by the dongle. A list
+ * holding a single value applies to every step, otherwise all lists
+ * in use must have the same length.
+ */
+class RidenSequencer
+{
+  public:
+    explicit RidenSequencer(RidenModbus &riden_modbus) : riden_modbus(riden_modbus) {}
+    bool begin();
+    bool loop();
+
+    bool set_voltages(const double *voltages, uint8_t count);
+    uint8_t get_voltage_count() { return voltage_count; }
+    const double *get_voltages() { return voltages; }
+    bool set_currents(const double *currents, uint8_t count);
+    uint8_t get_current_count() { return current_count; }
+    const double *get_currents() { return currents; }
+    bool set_dwells_ms(const uint32_t *dwells_ms, uint8_t count);
+    uint8_t get_dwell_count() { return dwell_count; }
+    const uint32_t *get_dwells_ms() { return dwells_ms; }
+
+    /**
+     * @brief Number of times to run through the lists, 0 for infinite.
+     */
+    void set_count(uint32_t count) { this->count = count; }
+    uint32_t get_count() { return count; }
+
+    /**
+     * @brief Whether voltage respectively current follow the lists when running.
+     */
+    void set_voltage_list_mode(bool on) { voltage_list_mode = on; }
+    bool is_voltage_list_mode() { return voltage_list_mode; }
+    void set_current_list_mode(bool on) { current_list_mode = on; }
+    bool is_current_list_mode() { return current_list_mode; }
+
+    /**
+     * @brief Start from the first step.
+     *
+     * @return false if no list is in use or the list lengths do not match.
+     */
+    bool start();
+    void abort();
+    bool is_running() { return running; }
+
+  private:
+    RidenModbus &riden_modbus;
+    bool initialized = false;
+
+    double voltages[SEQUENCER_MAX_POINTS] = {};
+    uint8_t voltage_count = 0;
+    double currents[SEQUENCER_MAX_POINTS] = {};
+    uint8_t current_count = 0;
+    uint32_t dwells_ms[SEQUENCER_MAX_POINTS] = {};
+    uint8_t dwell_count = 0;
+    uint32_t count = 1;
+    bool voltage_list_mode = false;
+    bool current_list_mode = false;
+
+    bool running = false;
+    uint8_t steps = 0;
+    uint8_t step = 0;
+    uint32_t repetition = 0;
+    bool step_applied = false;
+    unsigned long step_started_at = 0;
+
+    bool apply_step();
+};
+
+} // namespace RidenDongle
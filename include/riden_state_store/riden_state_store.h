@@ -0,0 +1,107 @@
+// SPDX-FileCopyrightText: 2024 Peder Toftegaard Olsen
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <riden_modbus/riden_modbus.h>
+#include <riden_ramp/riden_ramp.h>
+#include <riden_sequencer/riden_sequencer.h>
+
+#define STATE_STORE_MAGIC 0x52534154 // "RSAT"
+#define STATE_STORE_VERSION 1
+
+namespace RidenDongle
+{
+
+/**
+ * @brief The part of a saved state kept on the dongle.
+ */
+struct StoredState {
+    uint32_t magic;
+    uint32_t version;
+    bool output_on;
+    double voltage_slew;
+    double current_slew;
+    bool voltage_list_mode;
+    bool current_list_mode;
+    uint32_t count;
+    uint8_t voltage_count;
+    uint8_t current_count;
+    uint8_t dwell_count;
+    double voltages[SEQUENCER_MAX_POINTS];
+    double currents[SEQUENCER_MAX_POINTS];
+    uint32_t dwells_ms[SEQUENCER_MAX_POINTS];
+};
+
+/**
+ * @brief Saves and recalls the instrument state for *SAV and *RCL.
+ *
+ * Set points, OVP and OCP are stored in the M1..M9 presets of the
+ * power supply, written in a single transaction. Output state, slew
+ * rates and sequencer lists are stored in LittleFS on the dongle.
+ *
+ * The OVP and OCP in effect cannot be read back from the power
+ * supply, so the values saved are those last set through this class
+ * or recalled with recall().
+ */
+class RidenStateStore
+{
+  public:
+    explicit RidenStateStore(RidenModbus &riden_modbus, RidenRamp &riden_ramp, RidenSequencer &riden_sequencer)
+        : riden_modbus(riden_modbus), riden_ramp(riden_ramp), riden_sequencer(riden_sequencer) {}
+    bool begin();
+
+    /**
+     * @brief Set the OVP of the power supply, to be saved by save().
+     */
+    bool set_over_voltage_protection(double voltage);
+    /**
+     * @brief The OVP last set or recalled.
+     *
+     * @return false if not known, e.g. after a restart.
+     */
+    bool get_over_voltage_protection(double &voltage);
+    /**
+     * @brief Set the OCP of the power supply, to be saved by save().
+     */
+    bool set_over_current_protection(double current);
+    /**
+     * @brief The OCP last set or recalled.
+     *
+     * @return false if not known, e.g. after a restart.
+     */
+    bool get_over_current_protection(double &current);
+
+    /**
+     * @brief Save the current state.
+     *
+     * Fails if the OVP or OCP is not known.
+     *
+     * @param index One-based index, i.e. `1` refers to `M1`.
+     */
+    bool save(uint8_t index);
+
+    /**
+     * @brief Recall a saved state.
+     *
+     * Presets not saved with save() only select the preset.
+     *
+     * @param index One-based index, i.e. `1` refers to `M1`.
+     */
+    bool recall(uint8_t index);
+
+  private:
+    RidenModbus &riden_modbus;
+    RidenRamp &riden_ramp;
+    RidenSequencer &riden_sequencer;
+    bool initialized = false;
+
+    // OVP and OCP in effect, NAN when not known
+    double over_voltage_protection = NAN;
+    double over_current_protection = NAN;
+
+    void get_path(char *path, uint8_t index);
+};
+
+} // namespace RidenDongle
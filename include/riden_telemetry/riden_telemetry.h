@@ -0,0 +1,85 @@
+// SPDX-FileCopyrightText: 2024 Peder Toftegaard Olsen
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <riden_modbus/riden_modbus.h>
+
+#define TELEMETRY_INTERVAL_MS 1000
+#define TELEMETRY_WINDOW_MS 60000
+
+namespace RidenDongle
+{
+
+struct TelemetrySample {
+    unsigned long timestamp; // millis() when the sample was taken
+    double voltage;
+    double current;
+    double power;
+};
+
+struct TelemetryRange {
+    double min;
+    double max;
+    double avg;
+};
+
+struct TelemetryWindow {
+    uint32_t samples;
+    TelemetryRange voltage;
+    TelemetryRange current;
+    TelemetryRange power;
+};
+
+/**
+ * @brief Background sampling of the power supply output.
+ *
+ * Samples output voltage, current and power at a fixed interval,
+ * integrates energy on the dongle and keeps min/max/avg values for
+ * the last completed window.
+ */
+class RidenTelemetry
+{
+  public:
+    explicit RidenTelemetry(RidenModbus &riden_modbus) : riden_modbus(riden_modbus) {}
+    bool begin();
+    bool loop();
+
+    bool has_sample() { return sample_count > 0; }
+    const TelemetrySample &get_latest_sample() { return latest_sample; }
+    uint32_t get_sample_count() { return sample_count; }
+
+    /**
+     * @brief Energy delivered since boot or the last reset in Wh.
+     */
+    double get_energy_wh() { return energy_wh; }
+    void reset_energy() { energy_wh = 0; }
+
+    /**
+     * @brief Statistics of the last completed window.
+     */
+    const TelemetryWindow &get_window() { return last_window; }
+
+  private:
+    RidenModbus &riden_modbus;
+    bool initialized = false;
+
+    unsigned long next_sample_at = 0;
+    unsigned long window_started_at = 0;
+
+    TelemetrySample latest_sample = {};
+    uint32_t sample_count = 0;
+    double energy_wh = 0;
+
+    TelemetryWindow last_window = {};
+    TelemetryWindow current_window = {};
+    double voltage_sum = 0;
+    double current_sum = 0;
+    double power_sum = 0;
+
+    void add_sample(const TelemetrySample &sample);
+    void close_window();
+};
+
+} // namespace RidenDongle
@@ -0,0 +1,80 @@
+// SPDX-FileCopyrightText: 2024 Peder Toftegaard Olsen
+//
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <riden_modbus/riden_modbus.h>
+
+#define DEFAULT_TRIGGER_TIMER_MS 1000
+
+namespace RidenDongle
+{
+
+enum class TriggerSource {
+    Bus = 0,       // *TRG
+    Immediate = 1, // As soon as the trigger is armed
+    Timer = 2,     // A fixed time after the trigger is armed
+};
+
+/**
+ * @brief Applies staged voltage and current levels on a trigger.
+ *
+ * When both levels are staged they are written in a single Modbus
+ * transaction, so they take effect together.
+ */
+class RidenTrigger
+{
+  public:
+    explicit RidenTrigger(RidenModbus &riden_modbus) : riden_modbus(riden_modbus) {}
+    bool begin();
+    bool loop();
+
+    void set_source(TriggerSource source) { this->source = source; }
+    TriggerSource get_source() { return source; }
+    void set_timer_ms(uint32_t timer_ms) { this->timer_ms = timer_ms; }
+    uint32_t get_timer_ms() { return timer_ms; }
+
+    void set_voltage(double voltage);
+    bool has_voltage() { return voltage_staged; }
+    double get_voltage() { return voltage; }
+    void set_current(double current);
+    bool has_current() { return current_staged; }
+    double get_current() { return current; }
+
+    /**
+     * @brief Wait for the trigger event selected by the source.
+     *
+     * @return false if no level is staged.
+     */
+    bool arm();
+    bool is_armed() { return armed; }
+    /**
+     * @brief Bus trigger.
+     *
+     * @return false if the trigger is not armed with source Bus.
+     */
+    bool trigger();
+    void abort() { armed = false; }
+
+  private:
+    RidenModbus &riden_modbus;
+    bool initialized = false;
+
+    TriggerSource source = TriggerSource::Bus;
+    uint32_t timer_ms = DEFAULT_TRIGGER_TIMER_MS;
+
+    double voltage = 0;
+    bool voltage_staged = false;
+    double current = 0;
+    bool current_staged = false;
+
+    bool armed = false;
+    bool fired = false;
+    unsigned long armed_at = 0;
+
+    void fire();
+    bool apply();
+};
+
+} // namespace RidenDongle
@@ -2,12 +2,20 @@
 //
 // SPDX-License-Identifier: MIT
 
+#include <riden_acquisition/riden_acquisition.h>
 #include <riden_config/riden_config.h>
+#include <riden_hislip/riden_hislip.h>
 #include <riden_http_server/riden_http_server.h>
 #include <riden_logging/riden_logging.h>
 #include <riden_modbus/riden_modbus.h>
 #include <riden_modbus_bridge/riden_modbus_bridge.h>
+#include <riden_ramp/riden_ramp.h>
+#include <riden_regulator/riden_regulator.h>
 #include <riden_scpi/riden_scpi.h>
+#include <riden_scpi_console/riden_scpi_console.h>
+#include <riden_sequencer/riden_sequencer.h>
+#include <riden_telemetry/riden_telemetry.h>
+#include <riden_trigger/riden_trigger.h>
 #include <vxi11_server/rpc_bind_server.h>
 #include <vxi11_server/vxi_server.h>
 #include <scpi_bridge/scpi_bridge.h>
@@ -40,12 +48,20 @@ static bool did_update_time = false;
 static bool connected = false;
 
 static RidenModbus riden_modbus;                      ///< The modbus server
-static RidenScpi riden_scpi(riden_modbus);            ///< The raw socket server + the SCPI command handler
-static RidenModbusBridge modbus_bridge(riden_modbus); ///< The modbus TCP server
+static RidenTelemetry riden_telemetry(riden_modbus);  ///< Background sampling of the power supply output
+static RidenAcquisition riden_acquisition(riden_modbus); ///< Buffered sampling of the power supply output
+static RidenSequencer riden_sequencer(riden_modbus);     ///< Stepping through voltage and current lists
+static RidenRamp riden_ramp(riden_modbus);               ///< Slew rate limited voltage and current changes
+static RidenRegulator riden_regulator(riden_modbus);     ///< Constant power and constant resistance regulation
+static RidenTrigger riden_trigger(riden_modbus);         ///< Staged voltage and current applied on a trigger
+static RidenScpi riden_scpi(riden_modbus, riden_telemetry, riden_acquisition, riden_sequencer, riden_ramp, riden_regulator, riden_trigger); ///< The raw socket server + the SCPI command handler
+static RidenScpiConsole scpi_console(riden_scpi);   ///< The interactive telnet console for the SCPI command handler
+static RidenModbusBridge modbus_bridge(riden_modbus, riden_telemetry); ///< The modbus TCP server
 static SCPI_handler scpi_handler(riden_scpi);         ///< The bridge from the vxi server to the SCPI command handler
 static VXI_Server vxi_server(scpi_handler);           ///< The vxi server
 static RPC_Bind_Server rpc_bind_server(vxi_server);   ///< The RPC_Bind_Server for the vxi server
-static RidenHttpServer http_server(riden_modbus, riden_scpi, modbus_bridge, vxi_server); ///< The web server
+static RidenHislip hislip_server(riden_scpi);        ///< The HiSLIP server
+static RidenHttpServer http_server(riden_modbus, riden_scpi, modbus_bridge, vxi_server, hislip_server, riden_regulator); ///< The web server
 
 /**
  * Invoked by led_ticker to flash the LED.
@@ -102,9 +118,17 @@ void setup()
             delay(1000);
         }
 
+        riden_telemetry.begin();
+        riden_acquisition.begin();
+        riden_sequencer.begin();
+        riden_ramp.begin();
+        riden_regulator.begin();
+        riden_trigger.begin();
         riden_scpi.begin();
+        scpi_console.begin();
         modbus_bridge.begin();
         vxi_server.begin();
+        hislip_server.begin();
         rpc_bind_server.begin();
 
         // turn off led
@@ -194,10 +218,18 @@ void loop()
 
         MDNS.update();
         riden_modbus.loop();
+        riden_telemetry.loop();
+        riden_acquisition.loop();
+        riden_sequencer.loop();
+        riden_ramp.loop();
+        riden_regulator.loop();
+        riden_trigger.loop();
         riden_scpi.loop();
+        scpi_console.loop();
         modbus_bridge.loop();
         rpc_bind_server.loop();
         vxi_server.loop();
+        hislip_server.loop();
     }
     http_server.loop();
     ArduinoOTA.handle();
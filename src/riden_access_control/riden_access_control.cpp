@@ -0,0 +1,106 @@
+// SPDX-FileCopyrightText: 2024 Peder Toftegaard Olsen
+//
+// SPDX-License-Identifier: MIT
+
+#include <riden_access_control/riden_access_control.h>
+#include <riden_config/riden_config.h>
+#include <riden_logging/riden_logging.h>
+
+using namespace RidenDongle;
+
+static uint32_t to_host_order(const IPAddress &ip)
+{
+    return (uint32_t(ip[0]) << 24) | (uint32_t(ip[1]) << 16) | (uint32_t(ip[2]) << 8) | uint32_t(ip[3]);
+}
+
+/**
+ * Match a single allow-list entry, `a.b.c.d` or `a.b.c.d/prefix`.
+ */
+static bool matches_entry(const String &entry, uint32_t ip)
+{
+    String address = entry;
+    int prefix_length = 32;
+    int slash = entry.indexOf('/');
+    if (slash >= 0) {
+        address = entry.substring(0, slash);
+        prefix_length = entry.substring(slash + 1).toInt();
+        if (prefix_length < 0 || prefix_length > 32) {
+            return false;
+        }
+    }
+    IPAddress network;
+    if (!network.fromString(address)) {
+        return false;
+    }
+    uint32_t mask = (prefix_length == 0) ? 0 : (UINT32_MAX << (32 - prefix_length));
+    return (to_host_order(network) & mask) == (ip & mask);
+}
+
+bool RidenAccessControl::is_allowed(const IPAddress &ip)
+{
+    String allow_list = riden_config.get_allow_list();
+    allow_list.trim();
+    if (allow_list.length() == 0) {
+        return true;
+    }
+
+    uint32_t host_ip = to_host_order(ip);
+    int start = 0;
+    while (start < (int)allow_list.length()) {
+        int end = start;
+        while (end < (int)allow_list.length() && allow_list[end] != ',' && allow_list[end] != ' ') {
+            end++;
+        }
+        if (end > start && matches_entry(allow_list.substring(start, end), host_ip)) {
+            return true;
+        }
+        start = end + 1;
+    }
+    LOG_F("RidenAccessControl: rejected %s\r\n", ip.toString().c_str());
+    return false;
+}
+
+bool RidenAccessControl::consume(const IPAddress &ip)
+{
+    uint16_t rate_limit = riden_config.get_rate_limit();
+    if (rate_limit == 0) {
+        return true;
+    }
+    uint32_t capacity = uint32_t(max(riden_config.get_rate_burst(), uint16_t(1))) * 1000;
+
+    ClientBucket &bucket = get_bucket(uint32_t(ip), capacity);
+    unsigned long now = millis();
+    // rate_limit requests/s equals rate_limit 1/1000 requests/ms
+    uint64_t tokens = bucket.tokens + uint64_t(now - bucket.updated_at) * rate_limit;
+    bucket.tokens = min(tokens, uint64_t(capacity));
+    bucket.updated_at = now;
+
+    if (bucket.tokens < 1000) {
+        return false;
+    }
+    bucket.tokens -= 1000;
+    return true;
+}
+
+/**
+ * Find the bucket of a client. If the client is not tracked,
+ * the least recently used bucket is handed over to it.
+ */
+ClientBucket &RidenAccessControl::get_bucket(uint32_t ip, uint32_t capacity)
+{
+    ClientBucket *oldest = &buckets[0];
+    for (ClientBucket &bucket : buckets) {
+        if (bucket.ip == ip) {
+            return bucket;
+        }
+        if (bucket.ip == 0 || (oldest->ip != 0 && long(bucket.updated_at - oldest->updated_at) < 0)) {
+            oldest = &bucket;
+        }
+    }
+    oldest->ip = ip;
+    oldest->tokens = capacity;
+    oldest->updated_at = millis();
+    return *oldest;
+}
+
+RidenAccessControl RidenDongle::riden_access_control;
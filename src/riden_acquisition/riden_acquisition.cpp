@@ -0,0 +1,94 @@
+// SPDX-FileCopyrightText: 2024 Peder Toftegaard Olsen
+//
+// SPDX-License-Identifier: MIT
+
+#include <riden_acquisition/riden_acquisition.h>
+#include <riden_config/riden_config.h>
+#include <riden_logging/riden_logging.h>
+
+#include <Arduino.h>
+
+using namespace RidenDongle;
+
+bool RidenAcquisition::begin()
+{
+    if (initialized) {
+        return true;
+    }
+
+    LOG_LN("RidenAcquisition initializing");
+    LOG_LN("RidenAcquisition initialized");
+
+    initialized = true;
+    return true;
+}
+
+bool RidenAcquisition::loop()
+{
+    if (!initialized) {
+        return false;
+    }
+    if (!running) {
+        return true;
+    }
+
+    // Sample n is due at started_at + n * interval_ms, so a late
+    // sample does not delay the following ones. The due time is kept
+    // relative to the last one, as n * interval_ms may overflow.
+    if (count > 0 && millis() - last_due_at < interval_ms) {
+        return true;
+    }
+    double voltage, current, power;
+    if (!riden_modbus.get_output_values(voltage, current, power)) {
+        // Try again on the next call
+        return true;
+    }
+    voltages[count] = voltage;
+    currents[count] = current;
+    powers[count] = power;
+    last_due_at = count == 0 ? started_at : last_due_at + interval_ms;
+    count++;
+
+    if (count >= points) {
+        LOG_F("RidenAcquisition: acquired %u points\r\n", count);
+        running = false;
+    }
+    return true;
+}
+
+bool RidenAcquisition::set_points(uint16_t points)
+{
+    if (points < 1 || points > ACQUISITION_MAX_POINTS) {
+        return false;
+    }
+    this->points = points;
+    return true;
+}
+
+bool RidenAcquisition::set_interval_ms(uint32_t interval_ms)
+{
+    if (interval_ms < get_min_interval_ms()) {
+        return false;
+    }
+    this->interval_ms = interval_ms;
+    return true;
+}
+
+uint32_t RidenAcquisition::get_min_interval_ms()
+{
+    // 10 bits per byte with start and stop bits
+    const uint32_t baudrate = riden_config.get_uart_baudrate();
+    return ACQUISITION_RESPONSE_MS + (ACQUISITION_SAMPLE_BYTES * 10 * 1000 + baudrate - 1) / baudrate;
+}
+
+void RidenAcquisition::start()
+{
+    count = 0;
+    started_at = millis();
+    running = true;
+}
+
+void RidenAcquisition::abort()
+{
+    running = false;
+}
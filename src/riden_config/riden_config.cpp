@@ -9,7 +9,7 @@
 #include <EEPROM.h>
 
 #define MAGIC "RD"
-#define CURRENT_CONFIG_VERSION 2
+#define CURRENT_CONFIG_VERSION 3
 
 using namespace RidenDongle;
 
@@ -34,6 +34,18 @@ struct RidenConfigStructV2 {
     uint32_t uart_baudrate;
 };
 
+// V3 Configuration Struct
+struct RidenConfigStructV3 {
+    RidenConfigHeader header;
+    char tz_name[100];
+    bool config_portal_on_boot;
+    uint32_t uart_baudrate;
+    char allow_list[ALLOW_LIST_LENGTH];
+    uint16_t rate_limit;
+    uint16_t rate_burst;
+    bool write_guard;
+};
+
 #define STRINGIZER(arg) #arg
 #define STR_VALUE(arg) STRINGIZER(arg)
 
@@ -72,6 +84,20 @@ bool RidenConfig::begin()
             success = true;
             break;
         }
+        case 3: {
+            RidenConfigStructV3 config;
+            EEPROM.get(0, config);
+            tz_name = config.tz_name;
+            config_portal_on_boot = config.config_portal_on_boot;
+            uart_baudrate = config.uart_baudrate;
+            config.allow_list[ALLOW_LIST_LENGTH - 1] = 0;
+            allow_list = config.allow_list;
+            rate_limit = config.rate_limit;
+            rate_burst = config.rate_burst;
+            write_guard = config.write_guard;
+            success = true;
+            break;
+        }
         default:
             success = false;
         }
@@ -86,6 +112,9 @@ bool RidenConfig::begin()
         LOG_F("\tTimezone: %s\r\n", tz_name.c_str());
         LOG_F("\tPortal on boot: %s\r\n", (config_portal_on_boot) ? "Yes" : "No");
         LOG_F("\tUART baudrate: %u\r\n", uart_baudrate);
+        LOG_F("\tAllow list: %s\r\n", allow_list.c_str());
+        LOG_F("\tRate limit: %u/s, burst %u\r\n", rate_limit, rate_burst);
+        LOG_F("\tWrite guard: %s\r\n", (write_guard) ? "Yes" : "No");
     }
 
     return success;
@@ -148,21 +177,68 @@ void RidenConfig::set_uart_baudrate(uint32_t baudrate)
     this->uart_baudrate = baudrate;
 }
 
+String RidenConfig::get_allow_list()
+{
+    return allow_list;
+}
+
+void RidenConfig::set_allow_list(String allow_list)
+{
+    this->allow_list = allow_list.substring(0, ALLOW_LIST_LENGTH - 1);
+}
+
+uint16_t RidenConfig::get_rate_limit()
+{
+    return rate_limit;
+}
+
+void RidenConfig::set_rate_limit(uint16_t rate_limit)
+{
+    this->rate_limit = rate_limit;
+}
+
+uint16_t RidenConfig::get_rate_burst()
+{
+    return rate_burst;
+}
+
+void RidenConfig::set_rate_burst(uint16_t rate_burst)
+{
+    this->rate_burst = rate_burst;
+}
+
+bool RidenConfig::get_write_guard()
+{
+    return write_guard;
+}
+
+void RidenConfig::set_write_guard(bool write_guard)
+{
+    this->write_guard = write_guard;
+}
+
 bool RidenConfig::commit()
 {
 #ifdef MOCK_RIDEN
     return true;
 #else
-    RidenConfigStructV2 config;
+    RidenConfigStructV3 config;
     memcpy(config.header.magic, MAGIC, sizeof(MAGIC));
     config.header.config_version = CURRENT_CONFIG_VERSION;
     strcpy(config.tz_name, tz_name.c_str());
     config.config_portal_on_boot = config_portal_on_boot;
     config.uart_baudrate = uart_baudrate;
+    strcpy(config.allow_list, allow_list.c_str());
+    config.rate_limit = rate_limit;
+    config.rate_burst = rate_burst;
+    config.write_guard = write_guard;
     LOG_F("Saving configuration (%u bytes)\r\n", sizeof(config));
     LOG_F("\tTimezone: %s\r\n", config.tz_name);
     LOG_F("\tPortal on boot: %s\r\n", (config.config_portal_on_boot) ? "Yes" : "No");
     LOG_F("\tUART baudrate: %u\r\n", config.uart_baudrate);
+    LOG_F("\tAllow list: %s\r\n", config.allow_list);
+    LOG_F("\tRate limit: %u/s, burst %u\r\n", config.rate_limit, config.rate_burst);
+    LOG_F("\tWrite guard: %s\r\n", (config.write_guard) ? "Yes" : "No");
     EEPROM.put(0, config);
     bool success = EEPROM.commit();
     if (success) {
@@ -0,0 +1,412 @@
+// SPDX-FileCopyrightText: 2024 Peder Toftegaard Olsen
+//
+// SPDX-License-Identifier: MIT
+
+#include <riden_hislip/riden_hislip.h>
+#include <riden_logging/riden_logging.h>
+
+#include <Arduino.h>
+#include <ESP8266mDNS.h>
+
+using namespace RidenDongle;
+
+static uint32_t get_be32(const uint8_t *data)
+{
+    return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | data[3];
+}
+
+static void put_be32(uint8_t *data, uint32_t value)
+{
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+static uint64_t get_be64(const uint8_t *data)
+{
+    return (uint64_t(get_be32(data)) << 32) | get_be32(data + 4);
+}
+
+static void put_be64(uint8_t *data, uint64_t value)
+{
+    put_be32(data, value >> 32);
+    put_be32(data + 4, value);
+}
+
+bool RidenHislip::begin()
+{
+    if (initialized) {
+        return true;
+    }
+
+    LOG_LN("RidenHislip initializing");
+
+    tcpServer.begin();
+    tcpServer.setNoDelay(true);
+
+    if (MDNS.isRunning()) {
+        LOG_LN("RidenHislip advertising as hislip.");
+        MDNS.addService(NULL, "hislip", "tcp", tcpServer.port());
+    }
+
+    LOG_LN("RidenHislip initialized");
+
+    initialized = true;
+    return true;
+}
+
+bool RidenHislip::loop()
+{
+    if (!initialized) {
+        return false;
+    }
+
+    WiFiClient new_client = tcpServer.accept();
+    if (new_client) {
+        if (!riden_access_control.is_allowed(new_client.remoteIP()) || pending_client) {
+            new_client.stop();
+        } else {
+            LOG_LN("RidenHislip: New client.");
+            new_client.setNoDelay(true);
+            new_client.setTimeout(HISLIP_TIMEOUT_MS);
+            pending_client = new_client;
+            pending_since = millis();
+            pending_receiver = HislipReceiver();
+        }
+    }
+    if (pending_client) {
+        handle_pending_client();
+    }
+
+    if ((sync_client && !sync_client.connected()) || (async_client && !async_client.connected())) {
+        LOG_LN("RidenHislip: disconnect client.");
+        stop_session();
+    }
+    if (sync_client && session.is_waiting()) {
+        ScpiBufferedOutput output;
+        if (ridenScpi.resume(session, output)) {
+            response += output.text;
+            send_response();
+        }
+    }
+    if (sync_client && !session.is_waiting() && sync_client.available() > 0) {
+        handle_sync_message();
+    }
+    if (async_client && async_client.available() > 0) {
+        handle_async_message();
+    }
+
+    if (async_client) {
+        uint32_t service_requests = ridenScpi.get_service_request_count();
+        if (service_requests != service_requests_seen) {
+            service_requests_seen = service_requests;
+            send_message(async_client, HislipMessageType::AsyncServiceRequest, ridenScpi.read_status_byte(), 0);
+        }
+    }
+    return true;
+}
+
+uint16_t RidenHislip::port()
+{
+    return tcpServer.port();
+}
+
+const char *RidenHislip::get_visa_resource()
+{
+    static char visa_resource[40];
+    sprintf(visa_resource, "TCPIP::%s::hislip0::INSTR", WiFi.localIP().toString().c_str());
+    return visa_resource;
+}
+
+std::list<IPAddress> RidenHislip::get_connected_clients()
+{
+    std::list<IPAddress> connected_clients;
+    if (sync_client && sync_client.connected()) {
+        connected_clients.push_back(sync_client.remoteIP());
+    }
+    return connected_clients;
+}
+
+void RidenHislip::disconnect_client(const IPAddress &ip)
+{
+    if (sync_client && sync_client.connected() && sync_client.remoteIP() == ip) {
+        stop_session();
+    }
+}
+
+bool RidenHislip::read_header(WiFiClient &client, HislipHeader &header)
+{
+    uint8_t data[HISLIP_HEADER_LENGTH];
+    if (client.readBytes(data, HISLIP_HEADER_LENGTH) != HISLIP_HEADER_LENGTH || data[0] != 'H' || data[1] != 'S') {
+        return false;
+    }
+    header.message_type = HislipMessageType(data[2]);
+    header.control_code = data[3];
+    header.message_parameter = get_be32(&data[4]);
+    header.payload_length = get_be64(&data[8]);
+    return true;
+}
+
+/**
+ * @brief Read what has arrived of the message on client, without
+ * waiting for more.
+ *
+ * The payload is read into buffer. Once Complete is returned, the
+ * message is in receiver.header and buffer, and the next call starts
+ * on a new message.
+ */
+HislipReceiveResult RidenHislip::receive(WiFiClient &client, HislipReceiver &receiver, char *buffer, size_t buffer_size)
+{
+    if (!receiver.has_header) {
+        if (client.available() < HISLIP_HEADER_LENGTH) {
+            return HislipReceiveResult::Pending;
+        }
+        if (!read_header(client, receiver.header)) {
+            return HislipReceiveResult::PoorlyFormed;
+        }
+        if (receiver.header.payload_length > buffer_size) {
+            return HislipReceiveResult::TooLarge;
+        }
+        receiver.has_header = true;
+        receiver.payload_read = 0;
+    }
+    size_t remaining = receiver.header.payload_length - receiver.payload_read;
+    size_t available = min(size_t(client.available()), remaining);
+    if (available > 0) {
+        int read_length = client.read((uint8_t *)&buffer[receiver.payload_read], available);
+        if (read_length > 0) {
+            receiver.payload_read += read_length;
+        }
+    }
+    if (receiver.payload_read < receiver.header.payload_length) {
+        return HislipReceiveResult::Pending;
+    }
+    receiver.has_header = false;
+    return HislipReceiveResult::Complete;
+}
+
+void RidenHislip::send_message(WiFiClient &client, HislipMessageType message_type, uint8_t control_code, uint32_t message_parameter,
+                               const void *payload, size_t payload_length)
+{
+    uint8_t header[HISLIP_HEADER_LENGTH] = {'H', 'S', uint8_t(message_type), control_code};
+    put_be32(&header[4], message_parameter);
+    put_be64(&header[8], payload_length);
+    client.write(header, HISLIP_HEADER_LENGTH);
+    if (payload_length > 0) {
+        client.write(static_cast<const uint8_t *>(payload), payload_length);
+    }
+}
+
+void RidenHislip::send_fatal_error(WiFiClient &client, HislipFatalError error)
+{
+    LOG_F("RidenHislip: fatal error %u\n", uint8_t(error));
+    send_message(client, HislipMessageType::FatalError, uint8_t(error), 0);
+}
+
+void RidenHislip::send_error(WiFiClient &client, HislipError error)
+{
+    LOG_F("RidenHislip: error %u\n", uint8_t(error));
+    send_message(client, HislipMessageType::Error, uint8_t(error), 0);
+}
+
+/**
+ * @brief Report a message that could not be received; the caller
+ * closes the connection.
+ */
+void RidenHislip::send_receive_error(WiFiClient &client, HislipReceiveResult result)
+{
+    if (result == HislipReceiveResult::PoorlyFormed) {
+        send_fatal_error(client, HislipFatalError::PoorlyFormedHeader);
+    } else {
+        // Longer than the maximum message size, see AsyncMaximumMessageSize
+        send_fatal_error(client, HislipFatalError::Unidentified);
+    }
+}
+
+/**
+ * @brief Make a new connection the synchronous or asynchronous channel.
+ */
+void RidenHislip::handle_pending_client()
+{
+    // The payload is the sub-address, which is not used
+    HislipReceiveResult result = receive(pending_client, pending_receiver, pending_payload, sizeof(pending_payload));
+    if (result == HislipReceiveResult::Pending) {
+        if (!pending_client.connected() || millis() - pending_since > HISLIP_TIMEOUT_MS) {
+            pending_client.stop();
+        }
+        return;
+    }
+    if (result != HislipReceiveResult::Complete) {
+        send_receive_error(pending_client, result);
+        pending_client.stop();
+        return;
+    }
+    const HislipHeader &header = pending_receiver.header;
+
+    if (header.message_type == HislipMessageType::Initialize) {
+        if (sync_client) {
+            send_fatal_error(pending_client, HislipFatalError::MaximumClientsExceeded);
+            pending_client.stop();
+            return;
+        }
+        uint16_t version = min(uint16_t(header.message_parameter >> 16), uint16_t(HISLIP_PROTOCOL_VERSION));
+        session_id++;
+        sync_client = pending_client;
+        pending_client = WiFiClient();
+        session.ip = sync_client.remoteIP();
+        sync_receiver = HislipReceiver();
+        input_length = 0;
+        // Control code 0 selects synchronized mode
+        send_message(sync_client, HislipMessageType::InitializeResponse, 0, (uint32_t(version) << 16) | session_id);
+    } else if (header.message_type == HislipMessageType::AsyncInitialize
+               && sync_client && !async_client && header.message_parameter == session_id) {
+        async_client = pending_client;
+        pending_client = WiFiClient();
+        async_receiver = HislipReceiver();
+        service_requests_seen = ridenScpi.get_service_request_count();
+        send_message(async_client, HislipMessageType::AsyncInitializeResponse, 0, HISLIP_VENDOR_ID);
+    } else {
+        send_fatal_error(pending_client, HislipFatalError::InvalidInitializationSequence);
+        pending_client.stop();
+    }
+}
+
+void RidenHislip::handle_sync_message()
+{
+    // Data payloads are appended to input, other payloads are ignored
+    HislipReceiveResult result = receive(sync_client, sync_receiver, &input[input_length], sizeof(input) - input_length);
+    if (result == HislipReceiveResult::Pending) {
+        return;
+    }
+    if (result != HislipReceiveResult::Complete) {
+        send_receive_error(sync_client, result);
+        stop_session();
+        return;
+    }
+    const HislipHeader &header = sync_receiver.header;
+    if (!async_client) {
+        send_fatal_error(sync_client, HislipFatalError::ConnectionWithoutBothChannels);
+        stop_session();
+        return;
+    }
+
+    switch (header.message_type) {
+    case HislipMessageType::Data:
+    case HislipMessageType::DataEnd:
+        input_length += header.payload_length;
+        if (header.message_type == HislipMessageType::DataEnd) {
+            execute_input(header.message_parameter);
+        }
+        break;
+    case HislipMessageType::Trigger: {
+        ScpiBufferedOutput output;
+        ridenScpi.execute(session, "*TRG", 4, output);
+        break;
+    }
+    case HislipMessageType::DeviceClearComplete:
+        input_length = 0;
+        send_message(sync_client, HislipMessageType::DeviceClearAcknowledge, 0, 0);
+        break;
+    default:
+        send_error(sync_client, HislipError::UnrecognizedMessageType);
+        break;
+    }
+}
+
+void RidenHislip::handle_async_message()
+{
+    HislipReceiveResult result = receive(async_client, async_receiver, async_payload, sizeof(async_payload));
+    if (result == HislipReceiveResult::Pending) {
+        return;
+    }
+    if (result != HislipReceiveResult::Complete) {
+        send_receive_error(async_client, result);
+        stop_session();
+        return;
+    }
+    const HislipHeader &header = async_receiver.header;
+
+    switch (header.message_type) {
+    case HislipMessageType::AsyncLock:
+        // Locks, shared or exclusive, are the lock taken by SYSTem:LOCK
+        if (header.control_code == HISLIP_LOCK_REQUEST) {
+            bool granted = ridenScpi.request_lock(session);
+            send_message(async_client, HislipMessageType::AsyncLockResponse, granted ? HISLIP_LOCK_SUCCESS : HISLIP_LOCK_FAILURE, 0);
+        } else {
+            bool released = ridenScpi.release_lock(session);
+            send_message(async_client, HislipMessageType::AsyncLockResponse, released ? HISLIP_LOCK_SUCCESS : HISLIP_LOCK_ERROR, 0);
+        }
+        break;
+    case HislipMessageType::AsyncLockInfo: {
+        // Control code 1 when an exclusive lock is held, with the number of holders
+        bool locked = ridenScpi.is_locked();
+        send_message(async_client, HislipMessageType::AsyncLockInfoResponse, locked ? 1 : 0, locked ? 1 : 0);
+        break;
+    }
+    case HislipMessageType::AsyncRemoteLocalControl:
+        send_message(async_client, HislipMessageType::AsyncRemoteLocalResponse, 0, 0);
+        break;
+    case HislipMessageType::AsyncDeviceClear:
+        input_length = 0;
+        session.deferred = "";
+        response = "";
+        send_message(async_client, HislipMessageType::AsyncDeviceClearAcknowledge, 0, 0);
+        break;
+    case HislipMessageType::AsyncStatusQuery:
+        send_message(async_client, HislipMessageType::AsyncStatusResponse, ridenScpi.read_status_byte(), 0);
+        break;
+    case HislipMessageType::AsyncMaximumMessageSize: {
+        uint8_t maximum_message_size[8];
+        put_be64(maximum_message_size, SCPI_INPUT_BUFFER_LENGTH - 1);
+        send_message(async_client, HislipMessageType::AsyncMaximumMessageSizeResponse, 0, 0,
+                     maximum_message_size, sizeof(maximum_message_size));
+        break;
+    }
+    default:
+        send_error(async_client, HislipError::UnrecognizedMessageType);
+        break;
+    }
+}
+
+/**
+ * @brief Execute the message collected from Data and DataEnd.
+ *
+ * In synchronized mode the response carries the id of the message
+ * that caused it.
+ */
+void RidenHislip::execute_input(uint32_t message_id)
+{
+    ScpiBufferedOutput output;
+    ridenScpi.execute(session, input, input_length, output);
+    input_length = 0;
+    response_message_id = message_id;
+    response += output.text;
+    send_response();
+}
+
+/**
+ * @brief Send the response to the last message once all of it has
+ * executed, i.e. when no *OPC? or *WAI holds back the rest.
+ */
+void RidenHislip::send_response()
+{
+    if (session.is_waiting()) {
+        return;
+    }
+    if (response.length() > 0) {
+        send_message(sync_client, HislipMessageType::DataEnd, 0, response_message_id, response.c_str(), response.length());
+    }
+    response = "";
+}
+
+void RidenHislip::stop_session()
+{
+    sync_client.stop();
+    async_client.stop();
+    sync_client = WiFiClient();
+    async_client = WiFiClient();
+    input_length = 0;
+    response = "";
+    ridenScpi.end_session(session);
+}
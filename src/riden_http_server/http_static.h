@@ -190,7 +190,9 @@ static const char HTML_CONFIG_BODY_2[] PROGMEM =
 
 static const char HTML_CONFIG_BODY_3[] PROGMEM =
     "                    </select></td>"
-    "                </tr>"
+    "                </tr>";
+
+static const char HTML_CONFIG_BODY_4[] PROGMEM =
     "                <tr><th></th><td><input type='submit' value='Save'></td></tr>"
     "            </tbody>"
     "        </table>"
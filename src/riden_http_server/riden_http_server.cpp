@@ -17,6 +17,8 @@ using namespace RidenDongle;
 static const String scpi_protocol = "SCPI RAW";
 static const String modbustcp_protocol = "Modbus TCP";
 static const String vxi11_protocol = "VXI-11";
+static const String hislip_protocol = "HiSLIP";
+static const String websocket_protocol = "WebSocket";
 static const std::list<uint32_t> uart_baudrates = {
     9600,
     19200,
@@ -118,6 +120,10 @@ bool RidenHttpServer::begin()
     server.on("/set_i", HTTPMethod::HTTP_POST, std::bind(&RidenHttpServer::handle_set_i, this));
     server.on("/set_v", HTTPMethod::HTTP_POST, std::bind(&RidenHttpServer::handle_set_v, this));
     server.on("/toggle_out", HTTPMethod::HTTP_GET, std::bind(&RidenHttpServer::handle_toggle_out, this));
+    server.on("/regulation/", HTTPMethod::HTTP_GET, std::bind(&RidenHttpServer::handle_regulation_get, this));
+    server.on("/regulation/", HTTPMethod::HTTP_POST, std::bind(&RidenHttpServer::handle_regulation_post, this));
+    server.on("/performance/", HTTPMethod::HTTP_GET, std::bind(&RidenHttpServer::handle_performance_get, this));
+    server.on("/performance/", HTTPMethod::HTTP_POST, std::bind(&RidenHttpServer::handle_performance_post, this));
     server.on("/disconnect_client/", HTTPMethod::HTTP_POST, std::bind(&RidenHttpServer::handle_disconnect_client_post, this));
     server.on("/reboot/dongle/", HTTPMethod::HTTP_GET, std::bind(&RidenHttpServer::handle_reboot_dongle_get, this));
     server.on("/firmware/update/", HTTPMethod::HTTP_POST,
@@ -126,6 +132,10 @@ bool RidenHttpServer::begin()
     server.on("/lxi/identification", HTTPMethod::HTTP_GET, std::bind(&RidenHttpServer::handle_lxi_identification, this));
     server.on("/qps/modbus/", HTTPMethod::HTTP_GET, std::bind(&RidenHttpServer::handle_modbus_qps, this));
     server.onNotFound(std::bind(&RidenHttpServer::handle_not_found, this));
+    // WebSocket upgrade requests are taken over before the handlers above
+    server.addHook(websocket.hookForWebserver(WEBSOCKET_PATH,
+                                              std::bind(&RidenHttpServer::handle_websocket_event, this,
+                                                        std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4)));
     server.begin(port());
 
     if (MDNS.isRunning() && modbus.is_connected()) {
@@ -141,6 +151,14 @@ bool RidenHttpServer::begin()
 void RidenHttpServer::loop(void)
 {
     server.handleClient();
+    websocket.loop();
+    for (uint8_t num = 0; num < WEBSOCKETS_SERVER_CLIENT_MAX; num++) {
+        // Input held back by *OPC? or *WAI
+        ScpiBufferedOutput output;
+        if (scpi.resume(websocket_sessions[num], output) && output.text.length() > 0) {
+            websocket.sendTXT(num, output.text.c_str(), output.text.length());
+        }
+    }
 }
 
 uint16_t RidenHttpServer::port()
@@ -290,6 +308,15 @@ void RidenHttpServer::handle_config_get()
         }
     }
     server.sendContent_P(HTML_CONFIG_BODY_3);
+    server.sendContent("<tr><th>Allowed clients</th>"
+                       "<td><input type='text' name='allow_list' maxlength='" + String(ALLOW_LIST_LENGTH - 1) + "' placeholder='All' value='" + riden_config.get_allow_list() + "'></td></tr>");
+    server.sendContent("<tr><th>Rate limit (requests/s)</th>"
+                       "<td><input type='number' name='rate_limit' min='0' max='65535' value='" + String(riden_config.get_rate_limit()) + "'></td></tr>");
+    server.sendContent("<tr><th>Rate burst</th>"
+                       "<td><input type='number' name='rate_burst' min='1' max='65535' value='" + String(riden_config.get_rate_burst()) + "'></td></tr>");
+    server.sendContent("<tr><th>Block calibration and bootloader writes</th>"
+                       "<td><input type='checkbox' name='write_guard' value='true'" + String(riden_config.get_write_guard() ? " checked" : "") + "></td></tr>");
+    server.sendContent_P(HTML_CONFIG_BODY_4);
     server.sendContent_P(HTML_FOOTER);
     server.sendContent("");
 }
@@ -303,6 +330,24 @@ void RidenHttpServer::handle_config_post()
     LOG_F("Selected baudrate: %u\r\n", uart_baudrate);
     riden_config.set_timezone_name(tz);
     riden_config.set_uart_baudrate(uart_baudrate);
+
+    // Only keep characters that may appear in IP-addresses and prefixes
+    String allow_list_arg = server.arg("allow_list");
+    String allow_list;
+    for (unsigned int i = 0; i < allow_list_arg.length(); i++) {
+        char c = allow_list_arg[i];
+        if (isdigit(c) || c == '.' || c == '/' || c == ',' || c == ' ') {
+            allow_list += c;
+        }
+    }
+    uint32_t rate_limit = std::strtoul(server.arg("rate_limit").c_str(), nullptr, 10);
+    uint32_t rate_burst = std::strtoul(server.arg("rate_burst").c_str(), nullptr, 10);
+    LOG_F("Allowed clients: %s\r\n", allow_list.c_str());
+    LOG_F("Rate limit: %u/s, burst %u\r\n", rate_limit, rate_burst);
+    riden_config.set_allow_list(allow_list);
+    riden_config.set_rate_limit(min(rate_limit, uint32_t(UINT16_MAX)));
+    riden_config.set_rate_burst(constrain(rate_burst, uint32_t(1), uint32_t(UINT16_MAX)));
+    riden_config.set_write_guard(server.hasArg("write_guard"));
     riden_config.commit();
 
     send_redirect_self();
@@ -369,6 +414,14 @@ void RidenHttpServer::handle_disconnect_client_post()
             bridge.disconnect_client(ip);
         } else if (protocol == vxi11_protocol) {
             vxi_server.disconnect_client(ip);
+        } else if (protocol == hislip_protocol) {
+            hislip.disconnect_client(ip);
+        } else if (protocol == websocket_protocol) {
+            for (uint8_t num = 0; num < WEBSOCKETS_SERVER_CLIENT_MAX; num++) {
+                if (websocket.clientIsConnected(num) && websocket.remoteIP(num) == ip) {
+                    websocket.disconnect(num);
+                }
+            }
         }
     }
 
@@ -481,6 +534,134 @@ void RidenHttpServer::handle_toggle_out()
     }
 }
 
+void RidenHttpServer::handle_regulation_get()
+{
+    RegulationMode mode = regulator.get_mode();
+
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, "text/html", HTML_HEADER);
+    if (modbus.is_connected()) {
+        server.sendContent("<form method='post'>");
+        server.sendContent("    <div class='box'>");
+        server.sendContent("        <a style='float:right' href='.'>Refresh</a><h2>Regulation</h2>");
+        server.sendContent("        <table class='info'>");
+        server.sendContent("            <tbody>");
+        server.sendContent("                <tr><th>Mode</th><td><select name='mode'>");
+        server.sendContent("<option value='off'" + String(mode == RegulationMode::Off ? " selected" : "") + ">Off</option>");
+        server.sendContent("<option value='power'" + String(mode == RegulationMode::ConstantPower ? " selected" : "") + ">Constant power</option>");
+        server.sendContent("<option value='resistance'" + String(mode == RegulationMode::ConstantResistance ? " selected" : "") + ">Constant resistance</option>");
+        server.sendContent("                </select></td></tr>");
+        server.sendContent("<tr><th>Power (W)</th>"
+                           "<td><input type='number' name='power' min='0' step='0.01' value='" + String(regulator.get_power(), 2) + "'></td></tr>");
+        server.sendContent("<tr><th>Resistance (&#8486;)</th>"
+                           "<td><input type='number' name='resistance' min='0' step='0.001' value='" + String(regulator.get_resistance(), 3) + "'></td></tr>");
+        send_info_row("Update rate (Hz)", String(regulator.get_update_rate(), 1));
+        server.sendContent("                <tr><th></th><td><input type='submit' value='Apply'></td></tr>");
+        server.sendContent("            </tbody>");
+        server.sendContent("        </table>");
+        server.sendContent("    </div>");
+        server.sendContent("</form>");
+    } else {
+        server.sendContent_P(HTML_NO_CONNECTION_BODY);
+    }
+    server.sendContent_P(HTML_FOOTER);
+    server.sendContent("");
+}
+
+void RidenHttpServer::handle_regulation_post()
+{
+    double power = std::strtod(server.arg("power").c_str(), nullptr);
+    double resistance = std::strtod(server.arg("resistance").c_str(), nullptr);
+    String mode_arg = server.arg("mode");
+    RegulationMode mode = RegulationMode::Off;
+    if (mode_arg == "power") {
+        mode = RegulationMode::ConstantPower;
+    } else if (mode_arg == "resistance") {
+        mode = RegulationMode::ConstantResistance;
+    }
+    LOG_F("Regulation: %s, %f W, %f Ohm\r\n", mode_arg.c_str(), power, resistance);
+    regulator.set_power(max(power, 0.0));
+    regulator.set_resistance(max(resistance, 0.0));
+    if (!modbus.is_connected() || !regulator.set_mode(mode)) {
+        server.send(500, "text/plain", "Failed to set regulation mode");
+        return;
+    }
+
+    send_redirect_self();
+}
+
+void RidenHttpServer::handle_performance_get()
+{
+    const ScpiCommandProfile *profiles = scpi.get_command_profiles();
+
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, "text/html", HTML_HEADER);
+    server.sendContent("<form method='post'>");
+    server.sendContent("    <div class='box'>");
+    server.sendContent("        <a style='float:right' href='.'>Refresh</a><h2>SCPI Performance</h2>");
+    server.sendContent("        <table class='clients'>");
+    server.sendContent("            <thead><tr>");
+    server.sendContent("            <th>Command</th>");
+    server.sendContent("            <th>Calls</th>");
+    server.sendContent("            <th>Parse (ms)</th>");
+    server.sendContent("            <th>Modbus (ms)</th>");
+    server.sendContent("            <th>Total (ms)</th>");
+    server.sendContent("            <th>Average (ms)</th>");
+    server.sendContent("            </tr></thead>");
+    server.sendContent("            <tbody>");
+    for (uint16_t index = 0; profiles != nullptr && index < scpi.get_command_count(); index++) {
+        const ScpiCommandProfile &profile = profiles[index];
+        if (profile.calls == 0) {
+            continue;
+        }
+        server.sendContent("<tr><td>" + String(scpi.get_command_pattern(index)) + "</td>"
+                           "<td>" + String(profile.calls) + "</td>"
+                           "<td>" + String(profile.parse_us / 1000.0, 1) + "</td>"
+                           "<td>" + String(profile.modbus_us / 1000.0, 1) + "</td>"
+                           "<td>" + String(profile.total_us / 1000.0, 1) + "</td>"
+                           "<td>" + String(profile.total_us / 1000.0 / profile.calls, 2) + "</td></tr>");
+    }
+    server.sendContent("            </tbody>");
+    server.sendContent("        </table>");
+    server.sendContent("        <input type='submit' value='Reset'>");
+    server.sendContent("    </div>");
+    server.sendContent("</form>");
+    server.sendContent_P(HTML_FOOTER);
+    server.sendContent("");
+}
+
+void RidenHttpServer::handle_performance_post()
+{
+    scpi.reset_command_profiles();
+    send_redirect_self();
+}
+
+void RidenHttpServer::handle_websocket_event(uint8_t num, WStype_t type, uint8_t *payload, size_t length)
+{
+    switch (type) {
+    case WStype_CONNECTED:
+        if (!riden_access_control.is_allowed(websocket.remoteIP(num))) {
+            websocket.disconnect(num);
+            break;
+        }
+        websocket_sessions[num].ip = websocket.remoteIP(num);
+        break;
+    case WStype_DISCONNECTED:
+        scpi.end_session(websocket_sessions[num]);
+        break;
+    case WStype_TEXT: {
+        ScpiBufferedOutput output;
+        scpi.execute(websocket_sessions[num], (const char *)payload, length, output);
+        if (output.text.length() > 0) {
+            websocket.sendTXT(num, output.text.c_str(), output.text.length());
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
 void RidenHttpServer::send_redirect_root()
 {
     server.setContentLength(CONTENT_LENGTH_UNKNOWN);
@@ -506,7 +687,7 @@ void RidenHttpServer::send_redirect_self()
 void RidenHttpServer::send_dongle_info()
 {
     server.sendContent("        <div class='box'>");
-    server.sendContent("            <h2>Riden Dongle</h2>");
+    server.sendContent("            <a style='float:right' href='/performance/'>Performance</a><h2>Riden Dongle</h2>");
     server.sendContent("            <table class='info'>");
     server.sendContent("                <tbody>");
     send_info_row("Version", RidenDongle::version_string);
@@ -523,7 +704,8 @@ void RidenHttpServer::send_power_supply_info()
     String type = modbus.get_type();
 
     server.sendContent("        <div class='box'>");
-    server.sendContent("            <a style='float:right' href='/psu/'>Details</a><h2>Power Supply</h2>");
+    server.sendContent("            <a style='float:right' href='/psu/'>Details</a>"
+                       "<a style='float:right;margin-right:1em' href='/regulation/'>Regulation</a><h2>Power Supply</h2>");
     server.sendContent("            <table class='info'>");
     server.sendContent("                <tbody>");
     send_info_row("Model", type);
@@ -567,8 +749,11 @@ void RidenHttpServer::send_services()
     send_info_row("Web Server Port", String(this->port(), 10));
     send_info_row("Modbus TCP Port", String(bridge.port(), 10));
     send_info_row("VXI-11 Port", String(vxi_server.port(), 10));
+    send_info_row("HiSLIP Port", String(hislip.port(), 10));
     send_info_row("SCPI RAW Port", String(scpi.port(), 10));
+    send_info_row("SCPI WebSocket Path", WEBSOCKET_PATH);
     send_info_row("VISA Resource Address VXI-11", vxi_server.get_visa_resource());
+    send_info_row("VISA Resource Address HiSLIP", hislip.get_visa_resource());
     send_info_row("VISA Resource Address RAW", scpi.get_visa_resource());
     server.sendContent("                </tbody>");
     server.sendContent("            </table>");
@@ -589,12 +774,20 @@ void RidenHttpServer::send_connected_clients()
     for (auto const &ip : vxi_server.get_connected_clients()) {
         send_client_row(ip, vxi11_protocol);
     }    
+    for (auto const &ip : hislip.get_connected_clients()) {
+        send_client_row(ip, hislip_protocol);
+    }
     for (auto const &ip : scpi.get_connected_clients()) {
         send_client_row(ip, scpi_protocol);
     }
     for (auto const &ip : bridge.get_connected_clients()) {
         send_client_row(ip, modbustcp_protocol);
     }
+    for (uint8_t num = 0; num < WEBSOCKETS_SERVER_CLIENT_MAX; num++) {
+        if (websocket.clientIsConnected(num)) {
+            send_client_row(websocket.remoteIP(num), websocket_protocol);
+        }
+    }
     server.sendContent("                </tbody>");
     server.sendContent("            </table>");
     server.sendContent("        </div>");
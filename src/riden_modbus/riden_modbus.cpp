@@ -23,6 +23,19 @@ SoftwareSerial SerialRuideng = SoftwareSerial(MODBUS_RX, MODBUS_TX);
 
 using namespace RidenDongle;
 
+#ifndef MOCK_RIDEN
+// Outcome of the queued write in progress, set by queued_write_callback()
+static bool queued_write_done = false;
+static Modbus::ResultCode queued_write_result = Modbus::EX_SUCCESS;
+
+static bool queued_write_callback(Modbus::ResultCode event, uint16_t transaction_id, void *data)
+{
+    queued_write_done = true;
+    queued_write_result = event;
+    return true;
+}
+#endif
+
 bool RidenModbus::begin()
 {
 #ifdef MOCK_RIDEN
@@ -110,6 +123,12 @@ bool RidenModbus::loop()
     }
 
     modbus.task();
+    if (write_in_progress) {
+        complete_queued_write();
+    }
+    if (!write_in_progress && write_queue_length > 0 && !modbus.server()) {
+        send_queued_write();
+    }
     return true;
 #endif
 }
@@ -257,6 +276,12 @@ bool RidenModbus::set_current_set(const double current)
     return write_current(Register::CurrentSet, current);
 }
 
+bool RidenModbus::set_voltage_and_current_set(const double voltage, const double current)
+{
+    uint16_t values[2] = {voltage_to_value(voltage), current_to_value(current)};
+    return write_holding_registers(Register::VoltageSet, values, 2);
+}
+
 bool RidenModbus::get_voltage_out(double &voltage)
 {
     return read_voltage(Register::VoltageOut, voltage);
@@ -272,6 +297,43 @@ bool RidenModbus::get_power_out(double &power)
     return read_power(Register::PowerOut_H, power);
 }
 
+bool RidenModbus::get_output_values(double &voltage, double &current, double &power)
+{
+    uint16_t values[4];
+    if (!read_holding_registers(Register::VoltageOut, values, 4)) {
+        return false;
+    }
+    voltage = value_to_voltage(values[0]);
+    current = value_to_current(values[1]);
+    power = values_to_power(&(values[2]));
+    return true;
+}
+
+bool RidenModbus::get_measurements(Measurements &measurements)
+{
+    const uint16_t first = +Register::SystemTemperatureCelsius_Sign;
+    const uint16_t last = +Register::CurrentRange;
+    uint16_t values[last - first + 1];
+    if (!read_holding_registers(first, values, last - first + 1)) {
+        return false;
+    }
+    measurements.system_temperature_celsius = values_to_temperature(&(values[+Register::SystemTemperatureCelsius_Sign - first]));
+    measurements.system_temperature_fahrenheit = values_to_temperature(&(values[+Register::SystemTemperatureFarhenheit_Sign - first]));
+    measurements.voltage_set = value_to_voltage(values[+Register::VoltageSet - first]);
+    measurements.current_set = value_to_current(values[+Register::CurrentSet - first]);
+    measurements.voltage_out = value_to_voltage(values[+Register::VoltageOut - first]);
+    measurements.current_out = value_to_current(values[+Register::CurrentOut - first]);
+    measurements.power_out = values_to_power(&(values[+Register::PowerOut_H - first]));
+    measurements.voltage_in = value_to_voltage_in(values[+Register::VoltageIn - first]);
+    measurements.keypad_locked = values[+Register::Keypad - first] != 0;
+    measurements.protection = value_to_protection(values[+Register::Protection - first]);
+    measurements.output_mode = value_to_output_mode(values[+Register::OutputMode - first]);
+    measurements.output_on = values[+Register::Output - first] != 0;
+    measurements.preset = values[+Register::Preset - first];
+    measurements.current_range = values[+Register::CurrentRange - first];
+    return true;
+}
+
 bool RidenModbus::is_keypad_locked(bool &keypad)
 {
     return read_boolean(Register::Keypad, keypad);
@@ -287,6 +349,18 @@ bool RidenModbus::get_protection(Protection &protection)
     return true;
 }
 
+bool RidenModbus::get_status(Protection &protection, OutputMode &output_mode, bool &output_on)
+{
+    uint16_t values[3];
+    if (!read_holding_registers(Register::Protection, values, 3)) {
+        return false;
+    }
+    protection = value_to_protection(values[0]);
+    output_mode = value_to_output_mode(values[1]);
+    output_on = values[2] != 0;
+    return true;
+}
+
 bool RidenModbus::get_output_mode(OutputMode &output_mode)
 {
     uint16_t value;
@@ -307,6 +381,24 @@ bool RidenModbus::set_output_on(const bool on)
     return write_boolean(Register::Output, on);
 }
 
+bool RidenModbus::queue_voltage_set(const double voltage)
+{
+    const uint16_t value = voltage_to_value(voltage);
+    return queue_write(Register::VoltageSet, &value, 1);
+}
+
+bool RidenModbus::queue_current_set(const double current)
+{
+    const uint16_t value = current_to_value(current);
+    return queue_write(Register::CurrentSet, &value, 1);
+}
+
+bool RidenModbus::queue_output_on(const bool on)
+{
+    const uint16_t value = on ? 1 : 0;
+    return queue_write(Register::Output, &value, 1);
+}
+
 bool RidenModbus::set_preset(const uint8_t index)
 {
     if (index < 1 || index - 1 >= NUMBER_OF_PRESETS) {
@@ -513,7 +605,7 @@ bool RidenModbus::set_calibration(const Calibration calibration)
 
 bool RidenModbus::set_preset(const uint8_t index, const Preset &preset)
 {
-    if (index >= NUMBER_OF_PRESETS) {
+    if (index > NUMBER_OF_PRESETS) {
         return false;
     }
     uint16_t values[4];
@@ -524,7 +616,7 @@ bool RidenModbus::set_preset(const uint8_t index, const Preset &preset)
 
 bool RidenModbus::get_preset(const uint8_t index, Preset &preset)
 {
-    if (index >= NUMBER_OF_PRESETS) {
+    if (index > NUMBER_OF_PRESETS) {
         return false;
     }
     Register reg = Register(+Register::M0_V + 4 * index);
@@ -538,7 +630,7 @@ bool RidenModbus::get_preset(const uint8_t index, Preset &preset)
 
 bool RidenModbus::set_preset_voltage_out(const uint8_t index, const double voltage)
 {
-    if (index >= NUMBER_OF_PRESETS) {
+    if (index > NUMBER_OF_PRESETS) {
         return false;
     }
     const Register reg = Register(+Register::M0_V + 4 * index);
@@ -547,7 +639,7 @@ bool RidenModbus::set_preset_voltage_out(const uint8_t index, const double volta
 
 bool RidenModbus::get_preset_voltage_out(const uint8_t index, double &voltage)
 {
-    if (index >= NUMBER_OF_PRESETS) {
+    if (index > NUMBER_OF_PRESETS) {
         return false;
     }
     const Register reg = Register(+Register::M0_V + 4 * index);
@@ -556,7 +648,7 @@ bool RidenModbus::get_preset_voltage_out(const uint8_t index, double &voltage)
 
 bool RidenModbus::set_preset_current_out(const uint8_t index, const double current)
 {
-    if (index >= NUMBER_OF_PRESETS) {
+    if (index > NUMBER_OF_PRESETS) {
         return false;
     }
     const Register reg = Register(+Register::M0_I + 4 * index);
@@ -565,7 +657,7 @@ bool RidenModbus::set_preset_current_out(const uint8_t index, const double curre
 
 bool RidenModbus::get_preset_current_out(const uint8_t index, double &current)
 {
-    if (index >= NUMBER_OF_PRESETS) {
+    if (index > NUMBER_OF_PRESETS) {
         return false;
     }
     const Register reg = Register(+Register::M0_I + 4 * index);
@@ -574,7 +666,7 @@ bool RidenModbus::get_preset_current_out(const uint8_t index, double &current)
 
 bool RidenModbus::set_preset_over_voltage_protection(const uint8_t index, const double voltage)
 {
-    if (index >= NUMBER_OF_PRESETS) {
+    if (index > NUMBER_OF_PRESETS) {
         return false;
     }
     const Register reg = Register(+Register::M0_OVP + 4 * index);
@@ -583,7 +675,7 @@ bool RidenModbus::set_preset_over_voltage_protection(const uint8_t index, const
 
 bool RidenModbus::get_preset_over_voltage_protection(const uint8_t index, double &voltage)
 {
-    if (index >= NUMBER_OF_PRESETS) {
+    if (index > NUMBER_OF_PRESETS) {
         return false;
     }
     const Register reg = Register(+Register::M0_OVP + 4 * index);
@@ -592,7 +684,7 @@ bool RidenModbus::get_preset_over_voltage_protection(const uint8_t index, double
 
 bool RidenModbus::set_preset_over_current_protection(const uint8_t index, const double current)
 {
-    if (index >= NUMBER_OF_PRESETS) {
+    if (index > NUMBER_OF_PRESETS) {
         return false;
     }
     const Register reg = Register(+Register::M0_OCP + 4 * index);
@@ -601,7 +693,7 @@ bool RidenModbus::set_preset_over_current_protection(const uint8_t index, const
 
 bool RidenModbus::get_preset_over_current_protection(const uint8_t index, double &current)
 {
-    if (index >= NUMBER_OF_PRESETS) {
+    if (index > NUMBER_OF_PRESETS) {
         return false;
     }
     const Register reg = Register(+Register::M0_OCP + 4 * index);
@@ -680,6 +772,107 @@ bool RidenModbus::write_boolean(const Register reg, const boolean b)
     return write_holding_register(reg, value);
 }
 
+bool RidenModbus::queue_write(const Register reg, const uint16_t *values, const uint8_t numregs)
+{
+#ifdef MOCK_RIDEN
+    return true;
+#else
+    if (!initialized) {
+        return false;
+    }
+    if (write_queue_length == MODBUS_WRITE_QUEUE_LENGTH) {
+        // Make room by waiting for the queue to empty
+        flush_write_queue();
+    }
+    QueuedWrite &write = write_queue[(write_queue_start + write_queue_length) % MODBUS_WRITE_QUEUE_LENGTH];
+    write.offset = +reg;
+    write.numregs = numregs;
+    memcpy(write.values, values, numregs * sizeof(uint16_t));
+    write_queue_length++;
+    return true;
+#endif
+}
+
+/**
+ * Start sending the oldest queued write.
+ *
+ * @return false if it could not be sent.
+ */
+bool RidenModbus::send_queued_write()
+{
+#ifdef MOCK_RIDEN
+    return true;
+#else
+    QueuedWrite &write = write_queue[write_queue_start];
+    write_queue_start = (write_queue_start + 1) % MODBUS_WRITE_QUEUE_LENGTH;
+    write_queue_length--;
+
+    statistics.transactions++;
+    queued_write_done = false;
+    bool res;
+    if (write.numregs == 1) {
+        res = modbus.writeHreg(MODBUS_ADDRESS, write.offset, write.values[0], queued_write_callback);
+    } else {
+        res = modbus.writeHreg(MODBUS_ADDRESS, write.offset, write.values, write.numregs, queued_write_callback);
+    }
+    if (!res) {
+        statistics.failures++;
+        write_failed = true;
+        return false;
+    }
+    write_in_progress = true;
+    return true;
+#endif
+}
+
+/**
+ * Record the outcome of the write in progress once the power
+ * supply has responded or the request has timed out.
+ */
+void RidenModbus::complete_queued_write()
+{
+#ifndef MOCK_RIDEN
+    if (!queued_write_done) {
+        if (modbus.server()) {
+            return;
+        }
+        // Finished without invoking the callback
+        queued_write_result = Modbus::EX_SUCCESS;
+    }
+    write_in_progress = false;
+    if (queued_write_result != Modbus::EX_SUCCESS) {
+        if (queued_write_result == Modbus::EX_TIMEOUT) {
+            statistics.timeouts++;
+        }
+        statistics.failures++;
+        write_failed = true;
+    }
+#endif
+}
+
+void RidenModbus::flush_write_queue()
+{
+#ifndef MOCK_RIDEN
+    while (has_queued_writes()) {
+        if (!wait_for_inactive()) {
+            break;
+        }
+        if (write_in_progress) {
+            complete_queued_write();
+        } else {
+            send_queued_write();
+        }
+    }
+#endif
+}
+
+bool RidenModbus::take_write_failure()
+{
+    bool failed = write_failed;
+    write_failed = false;
+    return failed;
+}
+
 bool RidenModbus::wait_for_inactive()
 {
 #ifdef MOCK_RIDEN
@@ -691,15 +884,20 @@ bool RidenModbus::wait_for_inactive()
     // Wait until no transaction is active or timeout has passed
     unsigned long started_at = millis();
     unsigned long wait_until = started_at + timeout;
+    unsigned long started_at_us = micros();
+    bool success = true;
     while (modbus.server()) {
         delay(1);
         modbus.task();
         if (millis() > wait_until) {
             LOG_LN("Timed out waiting for response from power supply module");
-            return false;
+            statistics.timeouts++;
+            success = false;
+            break;
         }
     }
-    return true;
+    statistics.wait_us += micros() - started_at_us;
+    return success;
 #endif
 }
 
@@ -709,15 +907,20 @@ bool RidenModbus::read_holding_registers(const uint16_t offset, uint16_t *value,
     memset(value, 0, numregs * sizeof(uint16_t));
     return true;
 #else
+    if (has_queued_writes()) {
+        flush_write_queue();
+    }
     if (!wait_for_inactive()) {
         return false;
     }
+    statistics.transactions++;
     bool res = modbus.readHreg(MODBUS_ADDRESS, offset, value, numregs);
-    if (!res) {
+    // Wait until we receive an answer
+    if (!res || !wait_for_inactive()) {
+        statistics.failures++;
         return false;
     }
-    // Wait until we receive an answer
-    return wait_for_inactive();
+    return true;
 #endif
 }
 
@@ -726,15 +929,20 @@ bool RidenModbus::write_holding_register(const uint16_t offset, const uint16_t v
 #ifdef MOCK_RIDEN
     return true;
 #else  
+    if (has_queued_writes()) {
+        flush_write_queue();
+    }
     if (!wait_for_inactive()) {
         return false;
     }
+    statistics.transactions++;
     bool res = modbus.writeHreg(MODBUS_ADDRESS, offset, value);
-    if (!res) {
+    // Wait until we receive an answer
+    if (!res || !wait_for_inactive()) {
+        statistics.failures++;
         return false;
     }
-    // Wait until we receive an answer
-    return wait_for_inactive();
+    return true;
 #endif
 }
 
@@ -743,15 +951,20 @@ bool RidenModbus::write_holding_registers(const uint16_t offset, uint16_t *value
 #ifdef MOCK_RIDEN
     return true;
 #else
+    if (has_queued_writes()) {
+        flush_write_queue();
+    }
     if (!wait_for_inactive()) {
         return false;
     }
+    statistics.transactions++;
     bool res = modbus.writeHreg(MODBUS_ADDRESS, offset, value, numregs);
-    if (!res) {
+    // Wait until we receive an answer
+    if (!res || !wait_for_inactive()) {
+        statistics.failures++;
         return false;
     }
-    // Wait until we receive an answer
-    return wait_for_inactive();
+    return true;
 #endif
 }
 
@@ -2,7 +2,9 @@
 //
 // SPDX-License-Identifier: MIT
 
+#include <riden_config/riden_config.h>
 #include <riden_logging/riden_logging.h>
+#include <riden_modbus/riden_modbus_registers.h>
 #include <riden_modbus_bridge/riden_modbus_bridge.h>
 
 #include <ESP8266mDNS.h>
@@ -14,9 +16,66 @@ using namespace RidenDongle;
 // the time being we stick to only allowing a single
 // instance of RidenModbusBridge.
 static RidenModbusBridge *one_and_only = nullptr;
+static bool modbus_tcp_connect_callback(IPAddress ip);
 static Modbus::ResultCode modbus_tcp_raw_callback(uint8_t *data, uint8_t len, void *custom_data);
 static Modbus::ResultCode modbus_rtu_raw_callback(uint8_t *data, uint8_t len, void *custom);
 
+static uint16_t read_uint16(const uint8_t *data)
+{
+    return (uint16_t(data[0]) << 8) | uint16_t(data[1]);
+}
+
+struct WriteGuardRule {
+    uint16_t first;
+    uint16_t last;
+    bool any_value;  // Reject any write, not just writes of value
+    uint16_t value;
+};
+
+// Writes rejected when the write guard is enabled
+static const WriteGuardRule write_guard_rules[] = {
+    {+Register::V_OUT_ZERO, +Register::I_BACK_SCALE, true, 0},
+    {+Register::SYSTEM, +Register::SYSTEM, false, +Register::BOOTLOADER},
+};
+
+/**
+ * Check a write of count registers starting at address against
+ * write_guard_rules. values points at the big-endian values
+ * within the request, or is nullptr if they are not known.
+ */
+static bool is_guarded_write(uint16_t address, uint16_t count, const uint8_t *values)
+{
+    const uint32_t end = uint32_t(address) + count;
+    for (const WriteGuardRule &rule : write_guard_rules) {
+        if (end <= rule.first || address > rule.last) {
+            continue;
+        }
+        if (rule.any_value || values == nullptr) {
+            return true;
+        }
+        for (uint32_t reg = max(uint32_t(address), uint32_t(rule.first)); reg <= rule.last && reg < end; reg++) {
+            if (read_uint16(&values[2 * (reg - address)]) == rule.value) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void uint32_to_values(uint16_t *values, const uint32_t value)
+{
+    values[0] = uint16_t(value >> 16);
+    values[1] = uint16_t(value & 0xffff);
+}
+
+static void float_to_values(uint16_t *values, const double value)
+{
+    float f = value;
+    uint32_t raw;
+    memcpy(&raw, &f, sizeof(raw));
+    uint32_to_values(values, raw);
+}
+
 bool RidenModbusBridge::begin()
 {
     if (initialized) {
@@ -28,6 +87,7 @@ bool RidenModbusBridge::begin()
 
     LOG_LN("RidenModbusBridge initializing");
 
+    modbus_tcp.onConnect(::modbus_tcp_connect_callback);
     modbus_tcp.onRaw(::modbus_tcp_raw_callback);
     modbus_tcp.server();
 
@@ -46,7 +106,29 @@ bool RidenModbusBridge::begin()
 
 bool RidenModbusBridge::loop()
 {
+    // Each task() reads at most one request per client, so
+    // call it repeatedly to accept pipelined requests.
     modbus_tcp.task();
+    for (int i = 1; i < MODBUS_BRIDGE_MAX_IN_FLIGHT && modbus_tcp.has_pending_data(); i++) {
+        modbus_tcp.task();
+    }
+
+#ifndef MOCK_RIDEN
+    if (awaiting_response) {
+        // The response is forwarded by modbus_rtu_raw_callback()
+        riden_modbus.modbus.task();
+        if (awaiting_response && millis() - request_started_at > riden_modbus.timeout) {
+            LOG_LN("RidenModbusBridge: timed out waiting for response from power supply module");
+            riden_modbus.modbus.onRaw(nullptr);
+            riden_modbus.statistics.timeouts++;
+            send_error_response(ip, transaction_id, slave_id, function_code, Modbus::EX_DEVICE_FAILED_TO_RESPOND);
+            awaiting_response = false;
+        }
+    }
+    if (!awaiting_response) {
+        start_next_request();
+    }
+#endif
     return true;
 }
 
@@ -64,38 +146,58 @@ void RidenModbusBridge::disconnect_client(const IPAddress &ip)
 {
     LOG_LN("RidenModbusBridge::disconnect_client");
     modbus_tcp.disconnect_client(ip);
+
+    // Drop any request still queued for the client
+    uint8_t length = queue_length;
+    queue_length = 0;
+    for (uint8_t i = 0; i < length; i++) {
+        BridgeRequest &request = queue[(queue_head + i) % MODBUS_BRIDGE_QUEUE_SIZE];
+        if (request.ip != uint32_t(ip)) {
+            queue[(queue_head + queue_length) % MODBUS_BRIDGE_QUEUE_SIZE] = request;
+            queue_length++;
+        }
+    }
 }
 
 /**
- * Data received from the TCP-end is forwarded to ModbusRTU,
- * which in turn forwards it to the power supply.
+ * Clients not on the allow-list are refused.
+ */
+bool RidenModbusBridge::modbus_tcp_connect_callback(IPAddress ip)
+{
+    return riden_access_control.is_allowed(ip);
+}
+
+/**
+ * Data received from the TCP-end is queued for forwarding
+ * to ModbusRTU, which in turn forwards it to the power supply.
  */
 Modbus::ResultCode RidenModbusBridge::modbus_tcp_raw_callback(uint8_t *data, uint8_t len, void *custom_data)
 {
     if (!initialized) {
         return Modbus::EX_GENERAL_FAILURE;
     }
-    // Wait until no transaction is active
+    Modbus::frame_arg_t *source = (Modbus::frame_arg_t *)custom_data;
+    if (!riden_access_control.consume(source->ipaddr)) {
+        // Client exceeds its rate limit
+        send_error_response(source->ipaddr, source->transactionId, source->slaveId, data[0], Modbus::EX_SLAVE_DEVICE_BUSY);
+        return Modbus::EX_SUCCESS;
+    }
+    Modbus::ResultCode guard_result = check_write_guard(data, len);
+    if (guard_result != Modbus::EX_SUCCESS) {
+        send_error_response(source->ipaddr, source->transactionId, source->slaveId, data[0], guard_result);
+        return Modbus::EX_SUCCESS;
+    }
+    if (is_virtual_request(data, len)) {
+        handle_virtual_request(data, len, source);
+        return Modbus::EX_SUCCESS; // Stops ModbusTCP from processing the data
+    }
 #ifdef MOCK_RIDEN
     return Modbus::EX_SUCCESS;
 #else
-    while (riden_modbus.modbus.server()) {
-        delay(1);
-        riden_modbus.modbus.task();
-    }
-
-    Modbus::frame_arg_t *source = (Modbus::frame_arg_t *)custom_data;
-    if (!riden_modbus.modbus.rawRequest(source->slaveId, data, len)) {
-        // Inform TCP-end that processing failed
-        modbus_tcp.errorResponce(source->slaveId, (Modbus::FunctionCode)data[0], Modbus::EX_DEVICE_FAILED_TO_RESPOND);
-        return Modbus::EX_DEVICE_FAILED_TO_RESPOND; // Stop ModbusTCP from processing the data
+    if (!enqueue(data, len, source)) {
+        // Inform TCP-end that the request cannot be accepted right now
+        send_error_response(source->ipaddr, source->transactionId, source->slaveId, data[0], Modbus::EX_SLAVE_DEVICE_BUSY);
     }
-
-    // Set up ourself for forwarding the response to our ModbusTCP instance.
-    transaction_id = source->transactionId;
-    slave_id = source->slaveId;
-    ip = source->ipaddr;
-    riden_modbus.modbus.onRaw(::modbus_rtu_raw_callback);
     return Modbus::EX_SUCCESS; // Stops ModbusTCP from processing the data
 #endif
 }
@@ -112,26 +214,262 @@ Modbus::ResultCode RidenModbusBridge::modbus_rtu_raw_callback(uint8_t *data, uin
 #ifdef MOCK_RIDEN
     return Modbus::EX_SUCCESS;
 #else
+    const Modbus::frame_arg_t *source = static_cast<Modbus::frame_arg_t *>(custom);
+    if (source->to_server) {
+        return Modbus::EX_PASSTHROUGH;
+    }
 
     // Stop intercepting raw data
     riden_modbus.modbus.onRaw(nullptr);
 
-    const Modbus::frame_arg_t *source = static_cast<Modbus::frame_arg_t *>(custom);
-    if (!source->to_server) {
-        modbus_tcp.setTransactionId(transaction_id);
-        modbus_tcp.rawResponce(ip, data, len, slave_id);
-    } else {
-        return Modbus::EX_PASSTHROUGH;
-    }
+    send_response(ip, transaction_id, slave_id, data, len);
 
     // Clear state
+    awaiting_response = false;
     transaction_id = 0;
     slave_id = 0;
+    function_code = 0;
     ip = 0;
     return Modbus::EX_SUCCESS; // Stops ModbusRTU from processing the data
 #endif
 }
 
+bool RidenModbusBridge::enqueue(const uint8_t *data, uint8_t len, const Modbus::frame_arg_t *source)
+{
+    if (len == 0 || len > MODBUS_BRIDGE_MAX_PDU_LENGTH) {
+        return false;
+    }
+    if (queue_length >= MODBUS_BRIDGE_QUEUE_SIZE || count_in_flight(source->ipaddr) >= MODBUS_BRIDGE_MAX_IN_FLIGHT) {
+        LOG_LN("RidenModbusBridge: too many requests in flight");
+        return false;
+    }
+    BridgeRequest &request = queue[(queue_head + queue_length) % MODBUS_BRIDGE_QUEUE_SIZE];
+    request.ip = source->ipaddr;
+    request.transaction_id = source->transactionId;
+    request.slave_id = source->slaveId;
+    request.len = len;
+    memcpy(request.data, data, len);
+    queue_length++;
+    return true;
+}
+
+/**
+ * Requests queued or being processed for an IP-address,
+ * see MODBUS_BRIDGE_MAX_IN_FLIGHT.
+ */
+uint8_t RidenModbusBridge::count_in_flight(uint32_t ip)
+{
+    uint8_t count = (awaiting_response && this->ip == ip) ? 1 : 0;
+    for (uint8_t i = 0; i < queue_length; i++) {
+        if (queue[(queue_head + i) % MODBUS_BRIDGE_QUEUE_SIZE].ip == ip) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * Forward the next queued request to the power supply, unless
+ * a transaction is already active. In that case the request stays
+ * parked until a later call to loop().
+ *
+ * The response is passed on to the TCP-end by modbus_rtu_raw_callback().
+ */
+void RidenModbusBridge::start_next_request()
+{
+    while (queue_length > 0 && !riden_modbus.modbus.server()) {
+        BridgeRequest &request = queue[queue_head];
+        queue_head = (queue_head + 1) % MODBUS_BRIDGE_QUEUE_SIZE;
+        queue_length--;
+
+        if (!riden_modbus.modbus.rawRequest(request.slave_id, request.data, request.len)) {
+            // Inform TCP-end that processing failed
+            riden_modbus.statistics.failures++;
+            send_error_response(request.ip, request.transaction_id, request.slave_id, request.data[0], Modbus::EX_DEVICE_FAILED_TO_RESPOND);
+            continue;
+        }
+        riden_modbus.statistics.transactions++;
+
+        // Set up ourself for forwarding the response to our ModbusTCP instance.
+        awaiting_response = true;
+        request_started_at = millis();
+        transaction_id = request.transaction_id;
+        slave_id = request.slave_id;
+        function_code = request.data[0];
+        ip = request.ip;
+        riden_modbus.modbus.onRaw(::modbus_rtu_raw_callback);
+        return;
+    }
+}
+
+/**
+ * Reject writes to registers that may leave the power supply
+ * uncalibrated or stuck in the bootloader. The request is
+ * decoded in place.
+ *
+ * @return EX_SUCCESS if the request may be processed, otherwise the exception to respond with.
+ */
+Modbus::ResultCode RidenModbusBridge::check_write_guard(const uint8_t *data, uint8_t len)
+{
+    if (!riden_config.get_write_guard() || len < 1) {
+        return Modbus::EX_SUCCESS;
+    }
+
+    uint16_t address;
+    uint16_t count;
+    const uint8_t *values;
+    switch (data[0]) {
+    case Modbus::FC_WRITE_REG:
+        if (len < 5) {
+            return Modbus::EX_ILLEGAL_VALUE;
+        }
+        address = read_uint16(&data[1]);
+        count = 1;
+        values = &data[3];
+        break;
+    case Modbus::FC_WRITE_REGS:
+        if (len < 6) {
+            return Modbus::EX_ILLEGAL_VALUE;
+        }
+        address = read_uint16(&data[1]);
+        count = read_uint16(&data[3]);
+        values = &data[6];
+        if (len < 6 + 2 * count) {
+            return Modbus::EX_ILLEGAL_VALUE;
+        }
+        break;
+    case Modbus::FC_MASKWRITE_REG:
+        if (len < 7) {
+            return Modbus::EX_ILLEGAL_VALUE;
+        }
+        address = read_uint16(&data[1]);
+        count = 1;
+        values = nullptr; // The resulting value depends on the register contents
+        break;
+    case Modbus::FC_READWRITE_REGS:
+        if (len < 10) {
+            return Modbus::EX_ILLEGAL_VALUE;
+        }
+        address = read_uint16(&data[5]);
+        count = read_uint16(&data[7]);
+        values = &data[10];
+        if (len < 10 + 2 * count) {
+            return Modbus::EX_ILLEGAL_VALUE;
+        }
+        break;
+    default:
+        return Modbus::EX_SUCCESS;
+    }
+
+    if (is_guarded_write(address, count, values)) {
+        LOG_F("RidenModbusBridge: rejected write of %u registers at %u\r\n", count, address);
+        return Modbus::EX_ILLEGAL_ADDRESS;
+    }
+    return Modbus::EX_SUCCESS;
+}
+
+/**
+ * Requests for the VirtualRegister block.
+ */
+bool RidenModbusBridge::is_virtual_request(const uint8_t *data, uint8_t len)
+{
+    if (len < 3) {
+        return false;
+    }
+    switch (data[0]) {
+    case Modbus::FC_READ_REGS:
+    case Modbus::FC_READ_INPUT_REGS:
+    case Modbus::FC_WRITE_REG:
+    case Modbus::FC_WRITE_REGS:
+        return read_uint16(&data[1]) >= +VirtualRegister::FIRST;
+    default:
+        return false;
+    }
+}
+
+void RidenModbusBridge::handle_virtual_request(const uint8_t *data, uint8_t len, const Modbus::frame_arg_t *source)
+{
+    const uint8_t function_code = data[0];
+    if (function_code != Modbus::FC_READ_REGS && function_code != Modbus::FC_READ_INPUT_REGS) {
+        // The virtual registers are read-only
+        send_error_response(source->ipaddr, source->transactionId, source->slaveId, function_code, Modbus::EX_ILLEGAL_FUNCTION);
+        return;
+    }
+    if (len < 5) {
+        send_error_response(source->ipaddr, source->transactionId, source->slaveId, function_code, Modbus::EX_ILLEGAL_VALUE);
+        return;
+    }
+    const uint16_t address = read_uint16(&data[1]);
+    const uint16_t count = read_uint16(&data[3]);
+    if (count == 0 || count > 125) {
+        send_error_response(source->ipaddr, source->transactionId, source->slaveId, function_code, Modbus::EX_ILLEGAL_VALUE);
+        return;
+    }
+    if (uint32_t(address) + count > +VirtualRegister::END) {
+        send_error_response(source->ipaddr, source->transactionId, source->slaveId, function_code, Modbus::EX_ILLEGAL_ADDRESS);
+        return;
+    }
+
+    uint16_t values[+VirtualRegister::END - +VirtualRegister::FIRST];
+    get_virtual_registers(values);
+
+    uint8_t response[2 + 2 * (+VirtualRegister::END - +VirtualRegister::FIRST)];
+    response[0] = function_code;
+    response[1] = uint8_t(2 * count);
+    for (uint16_t i = 0; i < count; i++) {
+        const uint16_t value = values[address - +VirtualRegister::FIRST + i];
+        response[2 + 2 * i] = uint8_t(value >> 8);
+        response[3 + 2 * i] = uint8_t(value & 0xff);
+    }
+    send_response(source->ipaddr, source->transactionId, source->slaveId, response, 2 + 2 * count);
+}
+
+void RidenModbusBridge::get_virtual_registers(uint16_t *values)
+{
+    const uint16_t first = +VirtualRegister::FIRST;
+    const TelemetrySample &sample = riden_telemetry.get_latest_sample();
+    const TelemetryWindow &window = riden_telemetry.get_window();
+    const ModbusStatistics &statistics = riden_modbus.get_statistics();
+    uint32_t sample_age = riden_telemetry.has_sample() ? millis() - sample.timestamp : UINT32_MAX;
+
+    float_to_values(&values[+VirtualRegister::VoltageOut - first], sample.voltage);
+    float_to_values(&values[+VirtualRegister::CurrentOut - first], sample.current);
+    float_to_values(&values[+VirtualRegister::PowerOut - first], sample.power);
+    float_to_values(&values[+VirtualRegister::Energy - first], riden_telemetry.get_energy_wh());
+    float_to_values(&values[+VirtualRegister::VoltageMin - first], window.voltage.min);
+    float_to_values(&values[+VirtualRegister::VoltageMax - first], window.voltage.max);
+    float_to_values(&values[+VirtualRegister::VoltageAvg - first], window.voltage.avg);
+    float_to_values(&values[+VirtualRegister::CurrentMin - first], window.current.min);
+    float_to_values(&values[+VirtualRegister::CurrentMax - first], window.current.max);
+    float_to_values(&values[+VirtualRegister::CurrentAvg - first], window.current.avg);
+    float_to_values(&values[+VirtualRegister::PowerMin - first], window.power.min);
+    float_to_values(&values[+VirtualRegister::PowerMax - first], window.power.max);
+    float_to_values(&values[+VirtualRegister::PowerAvg - first], window.power.avg);
+    uint32_to_values(&values[+VirtualRegister::WindowSamples - first], window.samples);
+    uint32_to_values(&values[+VirtualRegister::SampleAge - first], sample_age);
+    uint32_to_values(&values[+VirtualRegister::Transactions - first], statistics.transactions);
+    uint32_to_values(&values[+VirtualRegister::Failures - first], statistics.failures);
+    uint32_to_values(&values[+VirtualRegister::Timeouts - first], statistics.timeouts);
+    uint32_to_values(&values[+VirtualRegister::Uptime - first], millis() / 1000);
+}
+
+void RidenModbusBridge::send_response(uint32_t ip, uint16_t transaction_id, uint8_t slave_id, uint8_t *data, uint8_t len)
+{
+    modbus_tcp.setTransactionId(transaction_id);
+    modbus_tcp.rawResponce(ip, data, len, slave_id);
+}
+
+void RidenModbusBridge::send_error_response(uint32_t ip, uint16_t transaction_id, uint8_t slave_id, uint8_t function_code, Modbus::ResultCode code)
+{
+    uint8_t response[2] = {uint8_t(function_code | 0x80), uint8_t(code)};
+    send_response(ip, transaction_id, slave_id, response, sizeof(response));
+}
+
+bool modbus_tcp_connect_callback(IPAddress ip)
+{
+    return one_and_only->modbus_tcp_connect_callback(ip);
+}
+
 Modbus::ResultCode modbus_tcp_raw_callback(uint8_t *data, uint8_t len, void *custom_data)
 {
     return one_and_only->modbus_tcp_raw_callback(data, len, custom_data);
@@ -153,6 +491,16 @@ std::list<IPAddress> RidenModbusTCP::get_connected_clients()
     return connected_clients;
 }
 
+bool RidenModbusTCP::has_pending_data()
+{
+    for (int i = 0; i < MODBUSIP_MAX_CLIENTS; i++) {
+        if (tcpclient[i] != nullptr && tcpclient[i]->available() > MODBUS_BRIDGE_MBAP_LENGTH) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void RidenModbusTCP::disconnect_client(const IPAddress &ip)
 {
     int8_t n = getMaster(ip);
@@ -0,0 +1,101 @@
+// SPDX-FileCopyrightText: 2024 Peder Toftegaard Olsen
+//
+// SPDX-License-Identifier: MIT
+
+#include <riden_logging/riden_logging.h>
+#include <riden_ramp/riden_ramp.h>
+
+#include <Arduino.h>
+
+using namespace RidenDongle;
+
+/**
+ * The value a ramp should have reached by now.
+ */
+static double ramp_value(const Ramp &ramp, unsigned long now)
+{
+    const double delta = ramp.slew * (now - ramp.started_at) / 1000.0;
+    if (ramp.to > ramp.from) {
+        return min(ramp.from + delta, ramp.to);
+    } else {
+        return max(ramp.from - delta, ramp.to);
+    }
+}
+
+bool RidenRamp::begin()
+{
+    if (initialized) {
+        return true;
+    }
+
+    LOG_LN("RidenRamp initializing");
+    LOG_LN("RidenRamp initialized");
+
+    initialized = true;
+    return true;
+}
+
+bool RidenRamp::loop()
+{
+    if (!initialized) {
+        return false;
+    }
+
+    if (voltage_ramp.active) {
+        const double voltage = ramp_value(voltage_ramp, millis());
+        const uint16_t value = riden_modbus.voltage_to_value(voltage);
+        if (value == voltage_ramp.value || (!riden_modbus.has_queued_writes() && riden_modbus.queue_voltage_set(voltage))) {
+            voltage_ramp.value = value;
+            voltage_ramp.active = voltage != voltage_ramp.to;
+        }
+    }
+    if (current_ramp.active) {
+        const double current = ramp_value(current_ramp, millis());
+        const uint16_t value = riden_modbus.current_to_value(current);
+        if (value == current_ramp.value || (!riden_modbus.has_queued_writes() && riden_modbus.queue_current_set(current))) {
+            current_ramp.value = value;
+            current_ramp.active = current != current_ramp.to;
+        }
+    }
+    return true;
+}
+
+bool RidenRamp::set_voltage(double voltage)
+{
+    if (voltage_slew <= 0) {
+        voltage_ramp.active = false;
+        return riden_modbus.queue_voltage_set(voltage);
+    }
+
+    double from;
+    if (voltage_ramp.active) {
+        from = ramp_value(voltage_ramp, millis());
+    } else if (!riden_modbus.get_voltage_set(from)) {
+        return false;
+    }
+    voltage_ramp = {true, from, voltage, voltage_slew, millis(), riden_modbus.voltage_to_value(from)};
+    return true;
+}
+
+bool RidenRamp::set_current(double current)
+{
+    if (current_slew <= 0) {
+        current_ramp.active = false;
+        return riden_modbus.queue_current_set(current);
+    }
+
+    double from;
+    if (current_ramp.active) {
+        from = ramp_value(current_ramp, millis());
+    } else if (!riden_modbus.get_current_set(from)) {
+        return false;
+    }
+    current_ramp = {true, from, current, current_slew, millis(), riden_modbus.current_to_value(from)};
+    return true;
+}
+
+void RidenRamp::abort()
+{
+    voltage_ramp.active = false;
+    current_ramp.active = false;
+}
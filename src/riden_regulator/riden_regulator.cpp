@@ -0,0 +1,121 @@
+// SPDX-FileCopyrightText: 2024 Peder Toftegaard Olsen
+//
+// SPDX-License-Identifier: MIT
+
+#include <riden_logging/riden_logging.h>
+#include <riden_regulator/riden_regulator.h>
+
+#include <Arduino.h>
+
+using namespace RidenDongle;
+
+bool RidenRegulator::begin()
+{
+    if (initialized) {
+        return true;
+    }
+
+    LOG_LN("RidenRegulator initializing");
+    LOG_LN("RidenRegulator initialized");
+
+    initialized = true;
+    return true;
+}
+
+bool RidenRegulator::loop()
+{
+    if (!initialized) {
+        return false;
+    }
+    if (mode == RegulationMode::Off) {
+        return true;
+    }
+
+    if (update()) {
+        updates++;
+    }
+
+    unsigned long now = millis();
+    if (now - rate_interval_started_at >= REGULATOR_RATE_INTERVAL_MS) {
+        update_rate = 1000.0 * updates / (now - rate_interval_started_at);
+        updates = 0;
+        rate_interval_started_at = now;
+        current_set_stale = true;
+    }
+    return true;
+}
+
+bool RidenRegulator::set_mode(RegulationMode mode)
+{
+    if (mode != RegulationMode::Off && this->mode == RegulationMode::Off) {
+        if (!riden_modbus.get_voltage_set(voltage_set)) {
+            return false;
+        }
+        voltage_set_value = riden_modbus.voltage_to_value(voltage_set);
+        open_circuit_voltage = voltage_set;
+        current_set_stale = true;
+        updates = 0;
+        update_rate = 0;
+        rate_interval_started_at = millis();
+    }
+    if (mode == RegulationMode::Off) {
+        update_rate = 0;
+    }
+    this->mode = mode;
+    return true;
+}
+
+/**
+ * Read the output and adjust the voltage.
+ *
+ * @return true if the update completed.
+ */
+bool RidenRegulator::update()
+{
+    double voltage, current, power;
+    if (!riden_modbus.get_output_values(voltage, current, power)) {
+        return false;
+    }
+
+    double target_voltage;
+    if (mode == RegulationMode::ConstantPower) {
+        if (current < REGULATOR_MIN_CURRENT) {
+            // No load to regulate against, e.g. when starting from 0 V or
+            // with the output off. Approach the lowest voltage that can
+            // deliver the target power within the current limit.
+            if (current_set_stale) {
+                if (!riden_modbus.get_current_set(current_set)) {
+                    return false;
+                }
+                current_set_stale = false;
+            }
+            if (current_set <= 0) {
+                return true;
+            }
+            target_voltage = target_power / current_set;
+        } else {
+            // Voltage delivering the target power into the present load
+            const double load_resistance = voltage / current;
+            target_voltage = sqrt(target_power * load_resistance);
+        }
+    } else {
+        target_voltage = open_circuit_voltage - current * target_resistance;
+    }
+    target_voltage = constrain(target_voltage, 0.0, riden_modbus.get_max_voltage());
+
+    // Move part of the way only, to keep the loop stable
+    const double new_voltage_set = voltage_set + REGULATOR_GAIN * (target_voltage - voltage_set);
+    const uint16_t value = riden_modbus.voltage_to_value(new_voltage_set);
+    if (value == voltage_set_value) {
+        // Keep converging on the unchanged register value
+        voltage_set = new_voltage_set;
+        return true;
+    }
+    // Wait for the previous write instead of queuing behind it
+    if (riden_modbus.has_queued_writes() || !riden_modbus.queue_voltage_set(new_voltage_set)) {
+        return false;
+    }
+    voltage_set = new_voltage_set;
+    voltage_set_value = value;
+    return true;
+}
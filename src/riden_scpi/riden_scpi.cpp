@@ -19,7 +19,9 @@
 // ** RAW socket
 // The default. Requires no special flags.
 // scpi-raw uses a raw TCP connection to send and receive SCPI commands.
-// This FW implementation supports only 1 client.
+// This FW implementation supports up to SCPI_MAX_CLIENTS clients sharing one parser.
+// Each client has its own input buffer, and lines are executed one client at a time.
+// A client may hold SYSTem:LOCK, leaving the other clients with queries only.
 // - Discovery is done via mDNS, and the service name is "scpi-raw" (_scpi-raw._tcp).
 // - The VISA string is like: "TCPIP::<ip address>::5025::SOCKET" (using the default port 5025)
 // - The SCPI commands and responses are sent as plain text, delimited by newline characters.
@@ -51,7 +53,8 @@
 // - The SCPI commands and responses are sent as binary data, with a header and a payload.
 // - It requires 2 connections on the same port (async and sync), even if you only use 1
 // - is discoverable by pyvisa, and requires no special construction in Python other than installation of zeroconf
-// ==> THE 2 CONNECTIONS MAKE IT NOT EASY TO DO WITHOUT REWRITING MUCH OF riden_scpi.cpp, AND WORK WAS ABANDONED
+// ==> this is in a parallel server, see riden_hislip. It passes complete messages to execute(),
+//     which does not depend on the connection they arrived on.
 
 
 #ifdef MOCK_RIDEN
@@ -60,8 +63,6 @@
 
 using namespace RidenDongle;
 
-// We only support one client
-
 const scpi_command_t RidenScpi::scpi_commands[] = {
     /* IEEE Mandated Commands (SCPI std V1999.0 4.1.1) */
     {"*CLS", SCPI_CoreCls, 0},
@@ -69,34 +70,43 @@ const scpi_command_t RidenScpi::scpi_commands[] = {
     {"*ESE?", SCPI_CoreEseQ, 0},
     {"*ESR?", SCPI_CoreEsrQ, 0},
     {"*IDN?", SCPI_CoreIdnQ, 0},
-    {"*OPC", SCPI_CoreOpc, 0},
-    {"*OPC?", SCPI_CoreOpcQ, 0},
+    {"*OPC", RidenScpi::Opc, 0},
+    {"*OPC?", RidenScpi::OpcQ, 0},
     {"*RST", SCPI_CoreRst, 0},
     {"*SRE", SCPI_CoreSre, 0},
     {"*SRE?", SCPI_CoreSreQ, 0},
-    {"*STB?", SCPI_CoreStbQ, 0},
+    {"*STB?", RidenScpi::StbQ, 0},
     {"*TST?", SCPI_CoreTstQ, 0},
-    {"*WAI", SCPI_CoreWai, 0},
+    {"*WAI", RidenScpi::Wai, 0},
 
     /* Required SCPI commands (SCPI std V1999.0 4.2.1) */
     {"SYSTem:ERRor[:NEXT]?", SCPI_SystemErrorNextQ, 0},
     {"SYSTem:ERRor:COUNt?", SCPI_SystemErrorCountQ, 0},
     {"SYSTem:VERSion?", SCPI_SystemVersionQ, 0},
 
-    {"STATus:OPERation?", SCPI_StatusOperationEventQ, 0},
-    {"STATus:OPERation:EVENt?", SCPI_StatusOperationEventQ, 0},
-    {"STATus:OPERation:CONDition?", SCPI_StatusOperationConditionQ, 0},
+    {"STATus:OPERation?", RidenScpi::StatusOperationEventQ, 0},
+    {"STATus:OPERation:EVENt?", RidenScpi::StatusOperationEventQ, 0},
+    {"STATus:OPERation:CONDition?", RidenScpi::StatusOperationConditionQ, 0},
     {"STATus:OPERation:ENABle", SCPI_StatusOperationEnable, 0},
     {"STATus:OPERation:ENABle?", SCPI_StatusOperationEnableQ, 0},
 
-    {"STATus:QUEStionable[:EVENt]?", SCPI_StatusQuestionableEventQ, 0},
-    {"STATus:QUEStionable:CONDition?", SCPI_StatusQuestionableConditionQ, 0},
+    {"STATus:QUEStionable[:EVENt]?", RidenScpi::StatusQuestionableEventQ, 0},
+    {"STATus:QUEStionable:CONDition?", RidenScpi::StatusQuestionableConditionQ, 0},
     {"STATus:QUEStionable:ENABle", SCPI_StatusQuestionableEnable, 0},
     {"STATus:QUEStionable:ENABle?", SCPI_StatusQuestionableEnableQ, 0},
 
     {"STATus:PRESet", SCPI_StatusPreset, 0},
 
+    {"*SAV", RidenScpi::Sav, 0},
     {"*RCL", RidenScpi::Rcl, 0},
+    {"*DMC", RidenScpi::Dmc, 0},
+    {"*GMC?", RidenScpi::GmcQ, 0},
+    {"*LMC?", RidenScpi::LmcQ, 0},
+    {"*PMC", RidenScpi::Pmc, 0},
+    {"*RMC", RidenScpi::Rmc, 0},
+    {"*EMC", RidenScpi::Emc, 0},
+    {"*EMC?", RidenScpi::EmcQ, 0},
+    {"*TRG", RidenScpi::Trg, 0},
     {"DISPlay:BRIGhtness", RidenScpi::DisplayBrightness, 0},
     {"DISPlay:BRIGhtness?", RidenScpi::DisplayBrightnessQ, 0},
     {"DISPlay:LANGuage", RidenScpi::DisplayLanguage, 0},
@@ -113,16 +123,73 @@ const scpi_command_t RidenScpi::scpi_commands[] = {
 
     {"[SOURce]:VOLTage[:LEVel][:IMMediate][:AMPLitude]", RidenScpi::SourceVoltage, 0},
     {"[SOURce]:VOLTage[:LEVel][:IMMediate][:AMPLitude]?", RidenScpi::SourceVoltageQ, 0},
+    {"[SOURce]:VOLTage:PROTection[:LEVel]", RidenScpi::SourceVoltageProtection, 0},
+    {"[SOURce]:VOLTage:PROTection[:LEVel]?", RidenScpi::SourceVoltageProtectionQ, 0},
     {"[SOURce]:VOLTage:PROTection:TRIPped?", RidenScpi::SourceVoltageProtectionTrippedQ, 0},
+    {"[SOURce]:VOLTage:SLEW[:IMMediate]", RidenScpi::SourceVoltageSlew, 0},
+    {"[SOURce]:VOLTage:SLEW[:IMMediate]?", RidenScpi::SourceVoltageSlewQ, 0},
 
     {"[SOURce]:CURRent[:LEVel][:IMMediate][:AMPLitude]", RidenScpi::SourceCurrent, 0},
     {"[SOURce]:CURRent[:LEVel][:IMMediate][:AMPLitude]?", RidenScpi::SourceCurrentQ, 0},
+    {"[SOURce]:CURRent:PROTection[:LEVel]", RidenScpi::SourceCurrentProtection, 0},
+    {"[SOURce]:CURRent:PROTection[:LEVel]?", RidenScpi::SourceCurrentProtectionQ, 0},
     {"[SOURce]:CURRent:PROTection:TRIPped?", RidenScpi::SourceCurrentProtectionTrippedQ},
+    {"[SOURce]:CURRent:SLEW[:IMMediate]", RidenScpi::SourceCurrentSlew, 0},
+    {"[SOURce]:CURRent:SLEW[:IMMediate]?", RidenScpi::SourceCurrentSlewQ, 0},
+
+    {"[SOURce]:VOLTage[:LEVel]:TRIGgered[:AMPLitude]", RidenScpi::SourceVoltageTriggered, 0},
+    {"[SOURce]:VOLTage[:LEVel]:TRIGgered[:AMPLitude]?", RidenScpi::SourceVoltageTriggeredQ, 0},
+    {"[SOURce]:CURRent[:LEVel]:TRIGgered[:AMPLitude]", RidenScpi::SourceCurrentTriggered, 0},
+    {"[SOURce]:CURRent[:LEVel]:TRIGgered[:AMPLitude]?", RidenScpi::SourceCurrentTriggeredQ, 0},
+    {"TRIGger[:SEQuence]:SOURce", RidenScpi::TriggerSequenceSource, 0},
+    {"TRIGger[:SEQuence]:SOURce?", RidenScpi::TriggerSequenceSourceQ, 0},
+    {"TRIGger[:SEQuence]:TIMer", RidenScpi::TriggerSequenceTimer, 0},
+    {"TRIGger[:SEQuence]:TIMer?", RidenScpi::TriggerSequenceTimerQ, 0},
+
+    {"[SOURce]:POWer[:LEVel][:IMMediate][:AMPLitude]", RidenScpi::SourcePower, 0},
+    {"[SOURce]:POWer[:LEVel][:IMMediate][:AMPLitude]?", RidenScpi::SourcePowerQ, 0},
+    {"[SOURce]:RESistance[:LEVel][:IMMediate][:AMPLitude]", RidenScpi::SourceResistance, 0},
+    {"[SOURce]:RESistance[:LEVel][:IMMediate][:AMPLitude]?", RidenScpi::SourceResistanceQ, 0},
+    {"[SOURce]:FUNCtion[:MODE]", RidenScpi::SourceFunction, 0},
+    {"[SOURce]:FUNCtion[:MODE]?", RidenScpi::SourceFunctionQ, 0},
+    {"[SOURce]:REGulation:RATE?", RidenScpi::SourceRegulationRateQ, 0},
 
     {"MEASure[:SCALar]:VOLTage[:DC]?", RidenScpi::MeasureVoltageQ, 0},
     {"MEASure[:SCALar]:CURRent[:DC]?", RidenScpi::MeasureCurrentQ, 0},
     {"MEASure[:SCALar]:POWer[:DC]?", RidenScpi::MeasurePowerQ, 0},
     {"MEASure[:SCALar]:TEMPerature[:THERmistor][:DC]?", RidenScpi::MeasureTemperatureQ, 0},
+    {"MEASure:ALL[:DC]?", RidenScpi::MeasureAllQ, 0},
+    {"FETCh:ALL[:DC]?", RidenScpi::FetchAllQ, 0},
+    {"FETCh[:SCALar]:VOLTage[:DC]?", RidenScpi::FetchVoltageQ, 0},
+    {"FETCh[:SCALar]:CURRent[:DC]?", RidenScpi::FetchCurrentQ, 0},
+    {"FETCh[:SCALar]:POWer[:DC]?", RidenScpi::FetchPowerQ, 0},
+
+    {"[SENSe]:SWEep:POINts", RidenScpi::SenseSweepPoints, 0},
+    {"[SENSe]:SWEep:POINts?", RidenScpi::SenseSweepPointsQ, 0},
+    {"[SENSe]:SWEep:TINTerval", RidenScpi::SenseSweepTimeInterval, 0},
+    {"[SENSe]:SWEep:TINTerval?", RidenScpi::SenseSweepTimeIntervalQ, 0},
+    {"INITiate[:IMMediate]", RidenScpi::Initiate, 0},
+    {"ABORt", RidenScpi::Abort, 0},
+    {"FETCh:ARRay:VOLTage[:DC]?", RidenScpi::FetchArrayVoltageQ, 0},
+    {"FETCh:ARRay:CURRent[:DC]?", RidenScpi::FetchArrayCurrentQ, 0},
+    {"FETCh:ARRay:POWer[:DC]?", RidenScpi::FetchArrayPowerQ, 0},
+    {"TRACe:DATA?", RidenScpi::TraceDataQ, 0},
+    {"TRACe:POINts:ACTual?", RidenScpi::TracePointsActualQ, 0},
+    {"FORMat[:DATA]", RidenScpi::FormatData, 0},
+    {"FORMat[:DATA]?", RidenScpi::FormatDataQ, 0},
+
+    {"[SOURce]:LIST:VOLTage[:LEVel]", RidenScpi::SourceListVoltage, 0},
+    {"[SOURce]:LIST:VOLTage[:LEVel]?", RidenScpi::SourceListVoltageQ, 0},
+    {"[SOURce]:LIST:CURRent[:LEVel]", RidenScpi::SourceListCurrent, 0},
+    {"[SOURce]:LIST:CURRent[:LEVel]?", RidenScpi::SourceListCurrentQ, 0},
+    {"[SOURce]:LIST:DWELl", RidenScpi::SourceListDwell, 0},
+    {"[SOURce]:LIST:DWELl?", RidenScpi::SourceListDwellQ, 0},
+    {"[SOURce]:LIST:COUNt", RidenScpi::SourceListCount, 0},
+    {"[SOURce]:LIST:COUNt?", RidenScpi::SourceListCountQ, 0},
+    {"[SOURce]:VOLTage:MODE", RidenScpi::SourceVoltageMode, 0},
+    {"[SOURce]:VOLTage:MODE?", RidenScpi::SourceVoltageModeQ, 0},
+    {"[SOURce]:CURRent:MODE", RidenScpi::SourceCurrentMode, 0},
+    {"[SOURce]:CURRent:MODE?", RidenScpi::SourceCurrentModeQ, 0},
 
     {"[SOURce]:VOLTage:LIMit", RidenScpi::SourceVoltageLimit, 0},
 
@@ -131,6 +198,13 @@ const scpi_command_t RidenScpi::scpi_commands[] = {
     {"SYSTem:BEEPer:STATe", RidenScpi::SystemBeeperState, 0},
     {"SYSTem:BEEPer:STATe?", RidenScpi::SystemBeeperStateQ, 0},
 
+    {"SYSTem:LOCK[:REQuest]?", RidenScpi::SystemLockRequestQ, 0},
+    {"SYSTem:LOCK:RELease", RidenScpi::SystemLockRelease, 0},
+    {"SYSTem:LOCK:OWNer?", RidenScpi::SystemLockOwnerQ, 0},
+
+    {"SYSTem:PERFormance?", RidenScpi::SystemPerformanceQ, 0},
+    {"SYSTem:PERFormance:RESet", RidenScpi::SystemPerformanceReset, 0},
+
     SCPI_CMD_LIST_END};
 
 scpi_choice_def_t temperature_options[] = {
@@ -156,6 +230,54 @@ scpi_interface_t RidenScpi::scpi_interface = {
     .reset = RidenScpi::SCPI_Reset,
 };
 
+scpi_choice_def_t trace_options[] = {
+    {.name = "VOLTage", .tag = 0},
+    {.name = "CURRent", .tag = 1},
+    {.name = "POWer", .tag = 2},
+    SCPI_CHOICE_LIST_END,
+};
+
+scpi_choice_def_t format_options[] = {
+    {.name = "ASCii", .tag = (int32_t)DataFormat::ASCII},
+    {.name = "REAL", .tag = (int32_t)DataFormat::REAL32},
+    {.name = "INTeger", .tag = (int32_t)DataFormat::INTEGER},
+    SCPI_CHOICE_LIST_END,
+};
+
+scpi_choice_def_t list_mode_options[] = {
+    {.name = "FIXed", .tag = 0},
+    {.name = "LIST", .tag = 1},
+    SCPI_CHOICE_LIST_END,
+};
+
+scpi_choice_def_t trigger_source_options[] = {
+    {.name = "BUS", .tag = (int32_t)TriggerSource::Bus},
+    {.name = "IMMediate", .tag = (int32_t)TriggerSource::Immediate},
+    {.name = "TIMer", .tag = (int32_t)TriggerSource::Timer},
+    SCPI_CHOICE_LIST_END,
+};
+
+scpi_choice_def_t function_options[] = {
+    {.name = "VOLTage", .tag = (int32_t)RegulationMode::Off},
+    {.name = "POWer", .tag = (int32_t)RegulationMode::ConstantPower},
+    {.name = "RESistance", .tag = (int32_t)RegulationMode::ConstantResistance},
+    SCPI_CHOICE_LIST_END,
+};
+
+scpi_choice_def_t output_mode_options[] = {
+    {.name = "CV", .tag = (int32_t)OutputMode::CONSTANT_VOLTAGE},
+    {.name = "CC", .tag = (int32_t)OutputMode::CONSTANT_CURRENT},
+    {.name = "XX", .tag = (int32_t)OutputMode::Unknown},
+    SCPI_CHOICE_LIST_END,
+};
+
+scpi_choice_def_t protection_options[] = {
+    {.name = "OVP", .tag = (int32_t)Protection::OVP},
+    {.name = "OCP", .tag = (int32_t)Protection::OCP},
+    {.name = "NONE", .tag = (int32_t)Protection::None},
+    SCPI_CHOICE_LIST_END,
+};
+
 size_t SCPI_ResultChoice(scpi_t *context, scpi_choice_def_t *options, int32_t value)
 {
     for (int i = 0; options[i].name; ++i) {
@@ -170,10 +292,34 @@ size_t RidenScpi::SCPI_Write(scpi_t *context, const char *data, size_t len)
 {
     RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
     LOG_F("SCPI_Write: writing \"%.*s\"\n", (int)len, data);
-    ridenScpi->external_output_ready = false; // don't send half baked data to the client
-    memcpy(&(ridenScpi->write_buffer[ridenScpi->write_buffer_length]), data, len);
-    ridenScpi->write_buffer_length += len;
-    
+    if (ridenScpi->current_output != nullptr) {
+        if (ridenScpi->current_output->write(data, len) < len) {
+            SCPI_ErrorPush(context, SCPI_ERROR_TOO_MUCH_DATA);
+            return 0;
+        }
+        return len;
+    }
+    if (ridenScpi->external_control) {
+        ridenScpi->external_output_ready = false; // don't send half baked data to the client
+        if (!ridenScpi->append_external_output(data, len)) {
+            LOG_F("ERROR: RidenScpi output buffer overflow. Dropping data.\n");
+            SCPI_ErrorPush(context, SCPI_ERROR_TOO_MUCH_DATA);
+            return 0;
+        }
+        return len;
+    }
+
+    // Stream to the raw socket client one buffer at a time
+    size_t written = 0;
+    while (written < len) {
+        if (ridenScpi->write_buffer_length == WRITE_BUFFER_LENGTH) {
+            ridenScpi->send_write_buffer();
+        }
+        size_t chunk = min(len - written, WRITE_BUFFER_LENGTH - ridenScpi->write_buffer_length);
+        memcpy(&ridenScpi->write_buffer[ridenScpi->write_buffer_length], &data[written], chunk);
+        ridenScpi->write_buffer_length += chunk;
+        written += chunk;
+    }
     return len;
 }
 
@@ -181,20 +327,71 @@ scpi_result_t RidenScpi::SCPI_Flush(scpi_t *context)
 {
     RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
 
+    if (ridenScpi->current_output != nullptr) {
+        ridenScpi->current_output->flush();
+        return SCPI_RES_OK;
+    }
     if (ridenScpi->external_control) {
         // do not write to the client, let the read function fetch the data
         ridenScpi->external_output_ready = true;
         return SCPI_RES_OK;
     }
     LOG_F("SCPI_Flush: sending \"%.*s\"\n", (int)ridenScpi->write_buffer_length, ridenScpi->write_buffer);
-    if (ridenScpi->client) {
-        ridenScpi->client.write(ridenScpi->write_buffer, ridenScpi->write_buffer_length);
-        ridenScpi->write_buffer_length = 0;
-        ridenScpi->client.flush();
+    ridenScpi->send_write_buffer();
+    ScpiClient *current_client = ridenScpi->current_client;
+    if (current_client != nullptr && current_client->client) {
+        current_client->client.flush();
     }
     return SCPI_RES_OK;
 }
 
+/**
+ * @brief Send the buffered output to the client whose command is executing.
+ */
+void RidenScpi::send_write_buffer()
+{
+    if (current_client != nullptr && current_client->client) {
+        current_client->client.write(write_buffer, write_buffer_length);
+    }
+    write_buffer_length = 0;
+}
+
+/**
+ * @brief Hold output until the VXI server reads it.
+ *
+ * @return false if the response would exceed EXTERNAL_OUTPUT_MAX_LENGTH.
+ */
+bool RidenScpi::append_external_output(const char *data, size_t len)
+{
+    size_t required = external_output_length + len;
+    if (required > EXTERNAL_OUTPUT_MAX_LENGTH) {
+        return false;
+    }
+    if (required > external_output_capacity) {
+        size_t capacity = max(external_output_capacity * 2, size_t(WRITE_BUFFER_LENGTH));
+        capacity = constrain(capacity, required, size_t(EXTERNAL_OUTPUT_MAX_LENGTH));
+        char *output = static_cast<char *>(realloc(external_output, capacity));
+        if (output == nullptr) {
+            return false;
+        }
+        external_output = output;
+        external_output_capacity = capacity;
+    }
+    memcpy(&external_output[external_output_length], data, len);
+    external_output_length += len;
+    return true;
+}
+
+void RidenScpi::clear_external_output()
+{
+    free(external_output);
+    external_output = nullptr;
+    external_output_length = 0;
+    external_output_capacity = 0;
+    external_output_position = 0;
+    external_output_ready = false;
+}
+
 int RidenScpi::SCPI_Error(scpi_t *context, int_fast16_t err)
 {
     (void)context;
@@ -205,7 +402,10 @@ int RidenScpi::SCPI_Error(scpi_t *context, int_fast16_t err)
 scpi_result_t RidenScpi::SCPI_Control(scpi_t *context, scpi_ctrl_name_t ctrl, scpi_reg_val_t val)
 {
     LOG_LN("SCPI_Control");
-    (void)context;
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+    if (SCPI_CTRL_SRQ == ctrl) {
+        ridenScpi->service_request_count++;
+    }
 #ifdef MODBUS_USE_SOFWARE_SERIAL
     if (SCPI_CTRL_SRQ == ctrl) {
         Serial.print("**SRQ: 0x");
@@ -231,6 +431,134 @@ scpi_result_t RidenScpi::SCPI_Reset(scpi_t *context)
     return SCPI_RES_OK;
 }
 
+/**
+ * @brief Execute a command from scpi_commands, accounting for its time.
+ *
+ * The tag of the profiled command is its index in scpi_commands.
+ */
+scpi_result_t RidenScpi::ProfileCommand(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    if (ridenScpi->deferred_at != nullptr) {
+        // Held back with the *OPC? or *WAI before it, see parse()
+        return SCPI_RES_OK;
+    }
+
+    int32_t index = context->param_list.cmd->tag;
+    ScpiCommandProfile &profile = ridenScpi->command_profiles[index];
+    unsigned long started_at = micros();
+    uint64_t modbus_us = ridenScpi->ridenModbus.get_statistics().wait_us;
+
+    scpi_result_t result = scpi_commands[index].callback(context);
+
+    unsigned long now = micros();
+    profile.calls++;
+    profile.parse_us += started_at - ridenScpi->parse_mark_us;
+    profile.modbus_us += ridenScpi->ridenModbus.get_statistics().wait_us - modbus_us;
+    profile.total_us += now - ridenScpi->parse_mark_us;
+    ridenScpi->parse_mark_us = now;
+    return result;
+}
+
+scpi_result_t RidenScpi::Opc(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    if (ridenScpi->operations_pending()) {
+        // Set the OPC bit from loop() once the operations complete
+        ridenScpi->operation_complete_pending = true;
+    } else {
+        SCPI_RegSetBits(context, SCPI_REG_ESR, ESR_OPC);
+    }
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::OpcQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    if (!ridenScpi->defer_until_complete(context)) {
+        SCPI_ResultInt32(context, 1);
+    }
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::Wai(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    ridenScpi->defer_until_complete(context);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::StbQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    ridenScpi->update_status();
+    return SCPI_CoreStbQ(context);
+}
+
+scpi_result_t RidenScpi::StatusOperationEventQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    ridenScpi->update_status();
+    return SCPI_StatusOperationEventQ(context);
+}
+
+scpi_result_t RidenScpi::StatusOperationConditionQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    ridenScpi->update_status();
+    return SCPI_StatusOperationConditionQ(context);
+}
+
+scpi_result_t RidenScpi::StatusQuestionableEventQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    ridenScpi->update_status();
+    return SCPI_StatusQuestionableEventQ(context);
+}
+
+scpi_result_t RidenScpi::StatusQuestionableConditionQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    ridenScpi->update_status();
+    return SCPI_StatusQuestionableConditionQ(context);
+}
+
+scpi_result_t RidenScpi::Sav(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    uint32_t profile;
+    if (!SCPI_ParamUnsignedInt(context, &profile, true)) {
+        return SCPI_RES_ERR;
+    }
+    if (profile < 1 || profile - 1 >= NUMBER_OF_PRESETS) {
+        SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+        return SCPI_RES_ERR;
+    }
+    double over_voltage_protection, over_current_protection;
+    if (!ridenScpi->state_store.get_over_voltage_protection(over_voltage_protection)
+        || !ridenScpi->state_store.get_over_current_protection(over_current_protection)) {
+        // Set with [SOURce]:VOLTage|CURRent:PROTection or *RCL first
+        SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+        return SCPI_RES_ERR;
+    }
+    if (ridenScpi->state_store.save(profile)) {
+        return SCPI_RES_OK;
+    } else {
+        SCPI_ErrorPush(context, SCPI_ERROR_MASS_STORAGE_ERROR);
+        return SCPI_RES_ERR;
+    }
+}
+
 scpi_result_t RidenScpi::Rcl(scpi_t *context)
 {
     RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
@@ -243,7 +571,9 @@ scpi_result_t RidenScpi::Rcl(scpi_t *context)
         SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
         return SCPI_RES_ERR;
     }
-    if (ridenScpi->ridenModbus.set_preset(profile)) {
+    // The recalled voltage would be overwritten by the regulator
+    ridenScpi->ridenRegulator.set_mode(RegulationMode::Off);
+    if (ridenScpi->state_store.recall(profile)) {
         return SCPI_RES_OK;
     } else {
         SCPI_ErrorPush(context, SCPI_ERROR_COMMAND);
@@ -251,6 +581,175 @@ scpi_result_t RidenScpi::Rcl(scpi_t *context)
     }
 }
 
+/**
+ * Read a macro label parameter.
+ *
+ * @return The length of the label, 0 on failure.
+ */
+static size_t param_macro_label(scpi_t *context, char *label)
+{
+    size_t len = 0;
+    if (!SCPI_ParamCopyText(context, label, SCPI_MACRO_LABEL_LENGTH, &len, TRUE)) {
+        return 0;
+    }
+    if (len == 0 || len >= SCPI_MACRO_LABEL_LENGTH) {
+        SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+        return 0;
+    }
+    label[len] = '\0';
+    return len;
+}
+
+scpi_result_t RidenScpi::Dmc(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    char label[SCPI_MACRO_LABEL_LENGTH];
+    size_t label_length = param_macro_label(context, label);
+    if (label_length == 0) {
+        return SCPI_RES_ERR;
+    }
+    if (memchr(label, '?', label_length) != nullptr) {
+        // Would pass as a query while another client holds SYSTem:LOCK
+        SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+        return SCPI_RES_ERR;
+    }
+
+    // The body is either a block or a string
+    scpi_parameter_t param;
+    if (!SCPI_Parameter(context, &param, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    const char *body = param.ptr;
+    size_t body_length = param.len;
+    if (param.type == SCPI_TOKEN_SINGLE_QUOTE_PROGRAM_DATA || param.type == SCPI_TOKEN_DOUBLE_QUOTE_PROGRAM_DATA) {
+        body++;
+        body_length -= 2;
+    } else if (param.type != SCPI_TOKEN_ARBITRARY_BLOCK_PROGRAM_DATA) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_TYPE_ERROR);
+        return SCPI_RES_ERR;
+    }
+    if (body_length > SCPI_MACRO_BODY_LENGTH) {
+        SCPI_ErrorPush(context, SCPI_ERROR_TOO_MUCH_DATA);
+        return SCPI_RES_ERR;
+    }
+
+    ScpiMacro *macro = ridenScpi->find_macro(label, label_length);
+    if (macro == nullptr) {
+        macro = ridenScpi->find_macro("", 0);
+        if (macro == nullptr) {
+            SCPI_ErrorPush(context, SCPI_ERROR_OUT_OF_MEMORY);
+            return SCPI_RES_ERR;
+        }
+    }
+    memcpy(macro->label, label, label_length + 1);
+    memcpy(macro->body, body, body_length);
+    macro->body_length = body_length;
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::GmcQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    char label[SCPI_MACRO_LABEL_LENGTH];
+    size_t label_length = param_macro_label(context, label);
+    if (label_length == 0) {
+        return SCPI_RES_ERR;
+    }
+    ScpiMacro *macro = ridenScpi->find_macro(label, label_length);
+    if (macro == nullptr) {
+        SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+        return SCPI_RES_ERR;
+    }
+    SCPI_ResultArbitraryBlock(context, macro->body, macro->body_length);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::LmcQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    bool any = false;
+    for (const ScpiMacro &macro : ridenScpi->macros) {
+        if (macro.label[0] != '\0') {
+            SCPI_ResultText(context, macro.label);
+            any = true;
+        }
+    }
+    if (!any) {
+        SCPI_ResultText(context, "");
+    }
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::Pmc(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    for (ScpiMacro &macro : ridenScpi->macros) {
+        macro.label[0] = '\0';
+    }
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::Rmc(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    char label[SCPI_MACRO_LABEL_LENGTH];
+    size_t label_length = param_macro_label(context, label);
+    if (label_length == 0) {
+        return SCPI_RES_ERR;
+    }
+    ScpiMacro *macro = ridenScpi->find_macro(label, label_length);
+    if (macro == nullptr) {
+        SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+        return SCPI_RES_ERR;
+    }
+    macro->label[0] = '\0';
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::Emc(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    int32_t enable;
+    if (!SCPI_ParamInt32(context, &enable, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    ridenScpi->macros_enabled = (enable != 0);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::EmcQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    SCPI_ResultInt32(context, ridenScpi->macros_enabled ? 1 : 0);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::Trg(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    if (ridenScpi->ridenTrigger.trigger()) {
+        return SCPI_RES_OK;
+    }
+    RidenSequencer &sequencer = ridenScpi->ridenSequencer;
+    if (!sequencer.is_voltage_list_mode() && !sequencer.is_current_list_mode()) {
+        SCPI_ErrorPush(context, SCPI_ERROR_TRIGGER_IGNORED);
+        return SCPI_RES_ERR;
+    }
+    if (!sequencer.start()) {
+        SCPI_ErrorPush(context, SCPI_ERROR_SETTINGS_CONFLICT);
+        return SCPI_RES_ERR;
+    }
+    return SCPI_RES_OK;
+}
+
 scpi_result_t RidenScpi::DisplayBrightness(scpi_t *context)
 {
     RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
@@ -401,7 +900,7 @@ scpi_result_t RidenScpi::OutputState(scpi_t *context)
     if (!SCPI_ParamBool(context, &on, true)) {
         return SCPI_RES_ERR;
     }
-    if (ridenScpi->ridenModbus.set_output_on(on)) {
+    if (ridenScpi->ridenModbus.queue_output_on(on)) {
         return SCPI_RES_OK;
     } else {
         SCPI_ErrorPush(context, SCPI_ERROR_COMMAND);
@@ -460,7 +959,18 @@ scpi_result_t RidenScpi::SourceVoltage(scpi_t *context)
         SCPI_ErrorPush(context, SCPI_ERROR_DATA_TYPE_ERROR);
         return SCPI_RES_ERR;
     }
-    if (ridenScpi->ridenModbus.set_voltage_set(value.content.value)) {
+    switch (ridenScpi->ridenRegulator.get_mode()) {
+    case RegulationMode::ConstantResistance:
+        // The regulator drops the voltage from the new level
+        ridenScpi->ridenRegulator.set_open_circuit_voltage(value.content.value);
+        return SCPI_RES_OK;
+    case RegulationMode::ConstantPower:
+        SCPI_ErrorPush(context, SCPI_ERROR_SETTINGS_CONFLICT);
+        return SCPI_RES_ERR;
+    default:
+        break;
+    }
+    if (ridenScpi->ridenRamp.set_voltage(value.content.value)) {
         return SCPI_RES_OK;
     } else {
         SCPI_ErrorPush(context, SCPI_ERROR_COMMAND);
@@ -474,6 +984,10 @@ scpi_result_t RidenScpi::SourceVoltageQ(scpi_t *context)
 
     double voltage;
 
+    if (ridenScpi->ridenRamp.is_voltage_ramping()) {
+        SCPI_ResultDouble(context, ridenScpi->ridenRamp.get_voltage_target());
+        return SCPI_RES_OK;
+    }
     if (ridenScpi->ridenModbus.get_voltage_set(voltage)) {
         SCPI_ResultDouble(context, voltage);
         return SCPI_RES_OK;
@@ -483,13 +997,68 @@ scpi_result_t RidenScpi::SourceVoltageQ(scpi_t *context)
     }
 }
 
-scpi_result_t RidenScpi::SourceVoltageProtectionTrippedQ(scpi_t *context)
+/**
+ * Read a protection level with an optional unit.
+ */
+static bool param_protection(scpi_t *context, double &level, scpi_unit_t unit)
+{
+    scpi_number_t value;
+    if (!SCPI_ParamNumber(context, scpi_special_numbers_def, &value, TRUE)) {
+        return false;
+    }
+    if (value.special) {
+        SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+        return false;
+    }
+    if (value.unit != SCPI_UNIT_NONE && value.unit != unit) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_TYPE_ERROR);
+        return false;
+    }
+    if (value.content.value < 0) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+        return false;
+    }
+    level = value.content.value;
+    return true;
+}
+
+scpi_result_t RidenScpi::SourceVoltageProtection(scpi_t *context)
 {
     RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
 
-    Protection protection;
-    if (ridenScpi->ridenModbus.get_protection(protection)) {
-        SCPI_ResultBool(context, protection == Protection::OVP);
+    double voltage;
+    if (!param_protection(context, voltage, SCPI_UNIT_VOLT)) {
+        return SCPI_RES_ERR;
+    }
+    if (ridenScpi->state_store.set_over_voltage_protection(voltage)) {
+        return SCPI_RES_OK;
+    } else {
+        SCPI_ErrorPush(context, SCPI_ERROR_COMMAND);
+        return SCPI_RES_ERR;
+    }
+}
+
+scpi_result_t RidenScpi::SourceVoltageProtectionQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    double voltage;
+    if (ridenScpi->state_store.get_over_voltage_protection(voltage)) {
+        SCPI_ResultDouble(context, voltage);
+        return SCPI_RES_OK;
+    } else {
+        SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+        return SCPI_RES_ERR;
+    }
+}
+
+scpi_result_t RidenScpi::SourceVoltageProtectionTrippedQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    Protection protection;
+    if (ridenScpi->ridenModbus.get_protection(protection)) {
+        SCPI_ResultBool(context, protection == Protection::OVP);
         return SCPI_RES_OK;
     } else {
         SCPI_ErrorPush(context, SCPI_ERROR_COMMAND);
@@ -511,7 +1080,7 @@ scpi_result_t RidenScpi::SourceCurrent(scpi_t *context)
         SCPI_ErrorPush(context, SCPI_ERROR_DATA_TYPE_ERROR);
         return SCPI_RES_ERR;
     }
-    if (ridenScpi->ridenModbus.set_current_set(value.content.value)) {
+    if (ridenScpi->ridenRamp.set_current(value.content.value)) {
         return SCPI_RES_OK;
     } else {
         SCPI_ErrorPush(context, SCPI_ERROR_COMMAND);
@@ -525,6 +1094,10 @@ scpi_result_t RidenScpi::SourceCurrentQ(scpi_t *context)
 
     double current;
 
+    if (ridenScpi->ridenRamp.is_current_ramping()) {
+        SCPI_ResultDouble(context, ridenScpi->ridenRamp.get_current_target());
+        return SCPI_RES_OK;
+    }
     if (ridenScpi->ridenModbus.get_current_set(current)) {
         SCPI_ResultDouble(context, current);
         return SCPI_RES_OK;
@@ -534,6 +1107,36 @@ scpi_result_t RidenScpi::SourceCurrentQ(scpi_t *context)
     }
 }
 
+scpi_result_t RidenScpi::SourceCurrentProtection(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    double current;
+    if (!param_protection(context, current, SCPI_UNIT_AMPER)) {
+        return SCPI_RES_ERR;
+    }
+    if (ridenScpi->state_store.set_over_current_protection(current)) {
+        return SCPI_RES_OK;
+    } else {
+        SCPI_ErrorPush(context, SCPI_ERROR_COMMAND);
+        return SCPI_RES_ERR;
+    }
+}
+
+scpi_result_t RidenScpi::SourceCurrentProtectionQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    double current;
+    if (ridenScpi->state_store.get_over_current_protection(current)) {
+        SCPI_ResultDouble(context, current);
+        return SCPI_RES_OK;
+    } else {
+        SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+        return SCPI_RES_ERR;
+    }
+}
+
 scpi_result_t RidenScpi::SourceCurrentProtectionTrippedQ(scpi_t *context)
 {
     RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
@@ -618,21 +1221,25 @@ scpi_result_t RidenScpi::MeasureTemperatureQ(scpi_t *context)
     }
 }
 
-scpi_result_t RidenScpi::SourceVoltageLimit(scpi_t *context)
+static void result_measurements(scpi_t *context, const Measurements &measurements)
 {
-    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+    SCPI_ResultDouble(context, measurements.voltage_out);
+    SCPI_ResultDouble(context, measurements.current_out);
+    SCPI_ResultDouble(context, measurements.power_out);
+    SCPI_ResultChoice(context, output_mode_options, (int32_t)measurements.output_mode);
+    SCPI_ResultChoice(context, protection_options, (int32_t)measurements.protection);
+    SCPI_ResultDouble(context, measurements.system_temperature_celsius);
+}
 
-    scpi_choice_def_t special;
-    scpi_number_t value;
+scpi_result_t RidenScpi::MeasureAllQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
 
-    if (!SCPI_ParamNumber(context, &special, &value, TRUE)) {
-        return SCPI_RES_ERR;
-    }
-    if (value.unit != SCPI_UNIT_NONE && value.unit != SCPI_UNIT_VOLT) {
-        SCPI_ErrorPush(context, SCPI_ERROR_DATA_TYPE_ERROR);
-        return SCPI_RES_ERR;
-    }
-    if (ridenScpi->ridenModbus.set_over_voltage_protection(value.content.value)) {
+    Measurements measurements;
+    if (ridenScpi->ridenModbus.get_measurements(measurements)) {
+        ridenScpi->last_measurements = measurements;
+        ridenScpi->has_measurements = true;
+        result_measurements(context, measurements);
         return SCPI_RES_OK;
     } else {
         SCPI_ErrorPush(context, SCPI_ERROR_COMMAND);
@@ -640,237 +1247,1653 @@ scpi_result_t RidenScpi::SourceVoltageLimit(scpi_t *context)
     }
 }
 
-scpi_result_t RidenScpi::SourceCurrentLimit(scpi_t *context)
+scpi_result_t RidenScpi::FetchAllQ(scpi_t *context)
 {
     RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
 
-    scpi_choice_def_t special;
-    scpi_number_t value;
-
-    if (!SCPI_ParamNumber(context, &special, &value, TRUE)) {
-        return SCPI_RES_ERR;
-    }
-    if (value.unit != SCPI_UNIT_NONE && value.unit != SCPI_UNIT_AMPER) {
-        SCPI_ErrorPush(context, SCPI_ERROR_DATA_TYPE_ERROR);
+    if (!ridenScpi->has_measurements) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_CORRUPT_OR_STALE);
         return SCPI_RES_ERR;
     }
-    if (ridenScpi->ridenModbus.set_over_current_protection(value.content.value)) {
-        return SCPI_RES_OK;
-    } else {
-        SCPI_ErrorPush(context, SCPI_ERROR_COMMAND);
+    result_measurements(context, ridenScpi->last_measurements);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::FetchVoltageQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    if (!ridenScpi->ridenTelemetry.has_sample()) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_CORRUPT_OR_STALE);
         return SCPI_RES_ERR;
     }
+    SCPI_ResultDouble(context, ridenScpi->ridenTelemetry.get_latest_sample().voltage);
+    return SCPI_RES_OK;
 }
 
-scpi_result_t RidenScpi::SystemBeeperState(scpi_t *context)
+scpi_result_t RidenScpi::FetchCurrentQ(scpi_t *context)
 {
     RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
 
-    bool on;
-    if (!SCPI_ParamBool(context, &on, TRUE)) {
+    if (!ridenScpi->ridenTelemetry.has_sample()) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_CORRUPT_OR_STALE);
         return SCPI_RES_ERR;
     }
-    if (ridenScpi->ridenModbus.set_buzzer_enabled(on)) {
-        return SCPI_RES_OK;
-    } else {
-        SCPI_ErrorPush(context, SCPI_ERROR_COMMAND);
+    SCPI_ResultDouble(context, ridenScpi->ridenTelemetry.get_latest_sample().current);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::FetchPowerQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    if (!ridenScpi->ridenTelemetry.has_sample()) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_CORRUPT_OR_STALE);
         return SCPI_RES_ERR;
     }
+    SCPI_ResultDouble(context, ridenScpi->ridenTelemetry.get_latest_sample().power);
+    return SCPI_RES_OK;
 }
 
-scpi_result_t RidenScpi::SystemBeeperStateQ(scpi_t *context)
+scpi_result_t RidenScpi::SenseSweepPoints(scpi_t *context)
 {
     RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
 
-    bool on;
-    if (ridenScpi->ridenModbus.is_buzzer_enabled(on)) {
-        SCPI_ResultBool(context, on);
-        return SCPI_RES_OK;
-    } else {
-        SCPI_ErrorPush(context, SCPI_ERROR_COMMAND);
+    uint32_t points;
+    if (!SCPI_ParamUnsignedInt(context, &points, true)) {
+        return SCPI_RES_ERR;
+    }
+    if (points > ACQUISITION_MAX_POINTS || !ridenScpi->ridenAcquisition.set_points(points)) {
+        SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
         return SCPI_RES_ERR;
     }
+    return SCPI_RES_OK;
 }
 
-/**
- * @brief Write data to the parser and the device.
- * It overwrites the data in the buffer from the raw socket server.
- * 
- * @param data data to be sent
- * @param len length of data
- */
-void RidenScpi::write(const char *data, size_t len) 
+scpi_result_t RidenScpi::SenseSweepPointsQ(scpi_t *context)
 {
-    if ((len == 0) || (data == NULL)) return;
-    // insert the data into the buffer.
-    if (len > SCPI_INPUT_BUFFER_LENGTH) {
-        LOG_F("ERROR: RidenScpi buffer overflow. Ignoring data.\n");
-        return;
-    }
-    memcpy(scpi_context.buffer.data, data, len);
-    scpi_context.buffer.position = len;
-    scpi_context.buffer.length = len;
-    external_control = true; // just to be sure
-    SCPI_Input(&scpi_context, NULL, 0);
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    SCPI_ResultUInt16(context, ridenScpi->ridenAcquisition.get_points());
+    return SCPI_RES_OK;
 }
 
-/**
- * @brief Read data from the parser and the device, this is the reaction to "write()"
- * 
- * @param data buffer to copy the data into
- * @param len length of data
- * @param max_len maximum length of data
- * @return scpi_result_t last error code
- */
-scpi_result_t RidenScpi::read(char *data, size_t *len, size_t max_len){
-    if (!external_control || len == NULL || data == NULL) {
+scpi_result_t RidenScpi::SenseSweepTimeInterval(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    scpi_choice_def_t special;
+    scpi_number_t value;
+
+    if (!SCPI_ParamNumber(context, &special, &value, TRUE)) {
         return SCPI_RES_ERR;
     }
-    *len = 0;
-    if (write_buffer_length > max_len) {
-        LOG_F("ERROR: RidenScpi output buffer overflow. Flushing the data.\n");
+    if (value.unit != SCPI_UNIT_NONE && value.unit != SCPI_UNIT_SECOND) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_TYPE_ERROR);
         return SCPI_RES_ERR;
     }
-    if (!external_output_ready) {
-
+    double interval_ms = value.content.value * 1000.0;
+    if (interval_ms > UINT32_MAX || !ridenScpi->ridenAcquisition.set_interval_ms(lround(interval_ms))) {
+        SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
         return SCPI_RES_ERR;
     }
-    memcpy(data, write_buffer, write_buffer_length);
-    *len = write_buffer_length;
-    write_buffer_length = 0;
     return SCPI_RES_OK;
 }
 
-bool RidenScpi::begin()
+scpi_result_t RidenScpi::SenseSweepTimeIntervalQ(scpi_t *context)
 {
-    if (initialized) {
-        return true;
-    }
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
 
-    LOG_LN("RidenScpi initializing");
+    SCPI_ResultDouble(context, ridenScpi->ridenAcquisition.get_interval_ms() / 1000.0);
+    return SCPI_RES_OK;
+}
 
-    String type = ridenModbus.get_type();
-    uint32_t serial_number;
-    ridenModbus.get_serial_number(serial_number);
-    uint16_t firmware_version;
-    ridenModbus.get_firmware_version(firmware_version);
-    memcpy(idn2, type.c_str(), type.length());
-    sprintf(idn3, "%08u", serial_number);
-    sprintf(idn4, "%u.%u", firmware_version / 100u, firmware_version % 100u);
+scpi_result_t RidenScpi::Initiate(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
 
-    SCPI_Init(&scpi_context,
-              scpi_commands,
-              &scpi_interface,
-              scpi_units_def,
-              idn1, idn2, idn3, idn4,
-              scpi_input_buffer, SCPI_INPUT_BUFFER_LENGTH,
-              scpi_error_queue_data, SCPI_ERROR_QUEUE_SIZE);
-    scpi_context.user_context = this;
+    RidenTrigger &trigger = ridenScpi->ridenTrigger;
+    RidenSequencer &sequencer = ridenScpi->ridenSequencer;
+    if (ridenScpi->ridenRegulator.get_mode() != RegulationMode::Off
+        && (trigger.has_voltage() || sequencer.is_voltage_list_mode())) {
+        // The regulator owns the voltage set point
+        SCPI_ErrorPush(context, SCPI_ERROR_SETTINGS_CONFLICT);
+        return SCPI_RES_ERR;
+    }
 
-    // Start TCP listener
-    tcpServer.begin();
-    tcpServer.setNoDelay(true);
+    ridenScpi->ridenAcquisition.start();
 
-    if (MDNS.isRunning()) {
-        LOG_LN("RidenScpi advertising as scpi-raw.");
-        auto scpi_service = MDNS.addService(NULL, "scpi-raw", "tcp", tcpServer.port());
-        MDNS.addServiceTxt(scpi_service, "version", SCPI_STD_VERSION_REVISION);
+    if (trigger.has_voltage() || trigger.has_current()) {
+        // The staged levels replace any level being ramped to
+        ridenScpi->ridenRamp.abort();
+        trigger.arm();
     }
 
-    LOG_LN("RidenScpi initialized");
+    if (sequencer.is_voltage_list_mode() || sequencer.is_current_list_mode()) {
+        if (!sequencer.start()) {
+            SCPI_ErrorPush(context, SCPI_ERROR_SETTINGS_CONFLICT);
+            return SCPI_RES_ERR;
+        }
+    }
+    return SCPI_RES_OK;
+}
 
-    initialized = true;
-    return true;
+scpi_result_t RidenScpi::Abort(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    ridenScpi->ridenAcquisition.abort();
+    ridenScpi->ridenSequencer.abort();
+    ridenScpi->ridenRamp.abort();
+    ridenScpi->ridenTrigger.abort();
+    return SCPI_RES_OK;
 }
 
-bool RidenScpi::loop()
+/**
+ * Return the samples in the selected data format. Binary formats
+ * are sent as an IEEE 488.2 definite length block.
+ */
+static scpi_result_t result_samples(scpi_t *context, RidenAcquisition &acquisition, int32_t trace, DataFormat format)
 {
-    if (external_control) {
-        // skip this loop if I'm under external control
-        if (client) {
-            LOG_LN("RidenScpi: disconnect client because I am under external control.");
-            client.stop();
-        }
-        return true;
+    const float *samples;
+    switch (trace) {
+    case 0:
+        samples = acquisition.get_voltages();
+        break;
+    case 1:
+        samples = acquisition.get_currents();
+        break;
+    default:
+        samples = acquisition.get_powers();
+        break;
     }
-
-    // Check for new client connecting
-    WiFiClient newClient = tcpServer.accept();
-    if (newClient) {
-        LOG_LN("RidenScpi: New client.");
-        if (!client) {
-            newClient.setTimeout(100);
-            newClient.setNoDelay(true);
-            client = newClient;
-            reset_buffers();
-        } else {
-            newClient.stop();
-        }
+    if (acquisition.get_count() == 0) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_CORRUPT_OR_STALE);
+        return SCPI_RES_ERR;
     }
-
-    // Check for incoming data
-    if (client) {
-        int bytes_available = client.available();
-        if (bytes_available > 0) {
-            // Now read until I find a newline. There may be way more data in the buffer than 1 command.
-            char buffer[1];
-            while (client.readBytes(buffer, 1) == 1) {
-                if (scpi_context.buffer.position >= SCPI_INPUT_BUFFER_LENGTH) {
-                    // Client is sending more data than we can handle
-                    LOG_F("ERROR: RidenScpi buffer overflow. Flushing data and killing connection.\n");
-                    scpi_context.buffer.position = 0;
-                    scpi_context.buffer.length = 0;
-                    client.stop();
-                    break;
-                }
-                // insert the character into the buffer.
-                scpi_context.buffer.data[scpi_context.buffer.position] = buffer[0];
-                scpi_context.buffer.position++;
-                scpi_context.buffer.length++;
-                if (buffer[0] == '\n') {
-                    LOG_F("RidenScpi: received %d bytes for handling\n", scpi_context.buffer.position);
-                    SCPI_Input(&scpi_context, NULL, 0);
-                    break;
-                }
-            }
+    const uint16_t count = acquisition.get_count();
+    switch (format) {
+    case DataFormat::REAL32:
+        SCPI_ResultArrayFloat(context, samples, count, SCPI_FORMAT_LITTLEENDIAN);
+        break;
+    case DataFormat::INTEGER:
+        SCPI_ResultArbitraryBlockHeader(context, count * sizeof(int32_t));
+        for (uint16_t i = 0; i < count; i++) {
+            const int32_t value = lround(samples[i] * 1000.0);
+            const uint8_t bytes[4] = {uint8_t(value), uint8_t(value >> 8), uint8_t(value >> 16), uint8_t(value >> 24)};
+            SCPI_ResultArbitraryBlockData(context, bytes, sizeof(bytes));
         }
+        break;
+    default:
+        SCPI_ResultArrayFloat(context, samples, count, SCPI_FORMAT_ASCII);
+        break;
     }
+    return SCPI_RES_OK;
+}
 
-    // Stop client which disconnects
-    if (client && !client.connected()) {
-        LOG_LN("RidenScpi: disconnect client.");
-        client.stop();
-    }
+scpi_result_t RidenScpi::FetchArrayVoltageQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
 
-    return true;
+    return result_samples(context, ridenScpi->ridenAcquisition, 0, ridenScpi->data_format);
 }
 
-uint16_t RidenScpi::port()
+scpi_result_t RidenScpi::FetchArrayCurrentQ(scpi_t *context)
 {
-    return tcpServer.port();
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    return result_samples(context, ridenScpi->ridenAcquisition, 1, ridenScpi->data_format);
 }
 
-std::list<IPAddress> RidenScpi::get_connected_clients()
+scpi_result_t RidenScpi::FetchArrayPowerQ(scpi_t *context)
 {
-    std::list<IPAddress> connected_clients;
-    if (client && client.connected()) {
-        connected_clients.push_back(client.remoteIP());
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    return result_samples(context, ridenScpi->ridenAcquisition, 2, ridenScpi->data_format);
+}
+
+scpi_result_t RidenScpi::TraceDataQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    int32_t trace;
+    if (!SCPI_ParamChoice(context, trace_options, &trace, TRUE)) {
+        return SCPI_RES_ERR;
     }
-    return connected_clients;
+    return result_samples(context, ridenScpi->ridenAcquisition, trace, ridenScpi->data_format);
 }
 
-void RidenScpi::disconnect_client(const IPAddress &ip)
+scpi_result_t RidenScpi::TracePointsActualQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    SCPI_ResultUInt16(context, ridenScpi->ridenAcquisition.get_count());
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::FormatData(scpi_t *context)
 {
-    if (client && client.connected() && client.remoteIP() == ip) {
-        client.stop();
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    int32_t format;
+    if (!SCPI_ParamChoice(context, format_options, &format, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    // Only 32 bit values are supported
+    int32_t length = 32;
+    if (!SCPI_ParamInt32(context, &length, FALSE)) {
+        if (SCPI_ParamErrorOccurred(context)) {
+            return SCPI_RES_ERR;
+        }
     }
+    if (format != (int32_t)DataFormat::ASCII && length != 32) {
+        SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+        return SCPI_RES_ERR;
+    }
+    ridenScpi->data_format = (DataFormat)format;
+    return SCPI_RES_OK;
 }
 
-void RidenScpi::reset_buffers()
+scpi_result_t RidenScpi::FormatDataQ(scpi_t *context)
 {
-    write_buffer_length = 0;
-    scpi_context.buffer.length = 0;
-    scpi_context.buffer.position = 0;
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    SCPI_ResultChoice(context, format_options, (int32_t)ridenScpi->data_format);
+    SCPI_ResultInt32(context, ridenScpi->data_format == DataFormat::ASCII ? 0 : 32);
+    return SCPI_RES_OK;
+}
+
+/**
+ * Read a comma-separated list of numbers in the given unit.
+ */
+static bool param_number_list(scpi_t *context, double *values, uint8_t &count, scpi_unit_t unit)
+{
+    count = 0;
+    scpi_number_t value;
+    while (SCPI_ParamNumber(context, scpi_special_numbers_def, &value, count == 0)) {
+        if (value.special || (value.unit != SCPI_UNIT_NONE && value.unit != unit)) {
+            SCPI_ErrorPush(context, SCPI_ERROR_DATA_TYPE_ERROR);
+            return false;
+        }
+        if (count >= SEQUENCER_MAX_POINTS) {
+            SCPI_ErrorPush(context, SCPI_ERROR_PARAMETER_NOT_ALLOWED);
+            return false;
+        }
+        values[count++] = value.content.value;
+    }
+    return count > 0 && !SCPI_ParamErrorOccurred(context);
+}
+
+scpi_result_t RidenScpi::SourceListVoltage(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    double voltages[SEQUENCER_MAX_POINTS];
+    uint8_t count;
+    if (!param_number_list(context, voltages, count, SCPI_UNIT_VOLT)) {
+        return SCPI_RES_ERR;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        if (voltages[i] < 0 || voltages[i] > ridenScpi->ridenModbus.get_max_voltage()) {
+            SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+            return SCPI_RES_ERR;
+        }
+    }
+    ridenScpi->ridenSequencer.set_voltages(voltages, count);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceListVoltageQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    RidenSequencer &sequencer = ridenScpi->ridenSequencer;
+    SCPI_ResultArrayDouble(context, sequencer.get_voltages(), sequencer.get_voltage_count(), SCPI_FORMAT_ASCII);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceListCurrent(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    double currents[SEQUENCER_MAX_POINTS];
+    uint8_t count;
+    if (!param_number_list(context, currents, count, SCPI_UNIT_AMPER)) {
+        return SCPI_RES_ERR;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        if (currents[i] < 0 || currents[i] > ridenScpi->ridenModbus.get_max_current()) {
+            SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+            return SCPI_RES_ERR;
+        }
+    }
+    ridenScpi->ridenSequencer.set_currents(currents, count);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceListCurrentQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    RidenSequencer &sequencer = ridenScpi->ridenSequencer;
+    SCPI_ResultArrayDouble(context, sequencer.get_currents(), sequencer.get_current_count(), SCPI_FORMAT_ASCII);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceListDwell(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    double dwells[SEQUENCER_MAX_POINTS];
+    uint8_t count;
+    if (!param_number_list(context, dwells, count, SCPI_UNIT_SECOND)) {
+        return SCPI_RES_ERR;
+    }
+    uint32_t dwells_ms[SEQUENCER_MAX_POINTS];
+    for (uint8_t i = 0; i < count; i++) {
+        if (dwells[i] < 0 || dwells[i] * 1000.0 > UINT32_MAX) {
+            SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+            return SCPI_RES_ERR;
+        }
+        dwells_ms[i] = lround(dwells[i] * 1000.0);
+    }
+    ridenScpi->ridenSequencer.set_dwells_ms(dwells_ms, count);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceListDwellQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    RidenSequencer &sequencer = ridenScpi->ridenSequencer;
+    for (uint8_t i = 0; i < sequencer.get_dwell_count(); i++) {
+        SCPI_ResultDouble(context, sequencer.get_dwells_ms()[i] / 1000.0);
+    }
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceListCount(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    scpi_number_t value;
+    if (!SCPI_ParamNumber(context, scpi_special_numbers_def, &value, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    if (value.special) {
+        if (value.content.tag != SCPI_NUM_INF) {
+            SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+            return SCPI_RES_ERR;
+        }
+        ridenScpi->ridenSequencer.set_count(0);
+        return SCPI_RES_OK;
+    }
+    if (value.content.value < 1 || value.content.value > UINT32_MAX) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+        return SCPI_RES_ERR;
+    }
+    ridenScpi->ridenSequencer.set_count(lround(value.content.value));
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceListCountQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    uint32_t count = ridenScpi->ridenSequencer.get_count();
+    if (count == 0) {
+        SCPI_ResultMnemonic(context, "INF");
+    } else {
+        SCPI_ResultUInt32(context, count);
+    }
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceVoltageMode(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    int32_t mode;
+    if (!SCPI_ParamChoice(context, list_mode_options, &mode, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    ridenScpi->ridenSequencer.set_voltage_list_mode(mode == 1);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceVoltageModeQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    SCPI_ResultChoice(context, list_mode_options, ridenScpi->ridenSequencer.is_voltage_list_mode() ? 1 : 0);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceCurrentMode(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    int32_t mode;
+    if (!SCPI_ParamChoice(context, list_mode_options, &mode, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    ridenScpi->ridenSequencer.set_current_list_mode(mode == 1);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceCurrentModeQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    SCPI_ResultChoice(context, list_mode_options, ridenScpi->ridenSequencer.is_current_list_mode() ? 1 : 0);
+    return SCPI_RES_OK;
+}
+
+/**
+ * Read a slew rate, where INFinity and 0 both mean an immediate change.
+ */
+static bool param_slew(scpi_t *context, double &slew, scpi_unit_t unit)
+{
+    scpi_number_t value;
+    if (!SCPI_ParamNumber(context, scpi_special_numbers_def, &value, TRUE)) {
+        return false;
+    }
+    if (value.special) {
+        if (value.content.tag != SCPI_NUM_INF) {
+            SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+            return false;
+        }
+        slew = 0;
+        return true;
+    }
+    if (value.unit != SCPI_UNIT_NONE && value.unit != unit) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_TYPE_ERROR);
+        return false;
+    }
+    if (value.content.value < 0) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+        return false;
+    }
+    slew = value.content.value;
+    return true;
+}
+
+static void result_slew(scpi_t *context, double slew)
+{
+    // SCPI represents infinity as 9.9E37
+    SCPI_ResultDouble(context, (slew > 0) ? slew : 9.9e37);
+}
+
+scpi_result_t RidenScpi::SourceVoltageSlew(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    double slew;
+    if (!param_slew(context, slew, SCPI_UNIT_VOLT)) {
+        return SCPI_RES_ERR;
+    }
+    ridenScpi->ridenRamp.set_voltage_slew(slew);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceVoltageSlewQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    result_slew(context, ridenScpi->ridenRamp.get_voltage_slew());
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceCurrentSlew(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    double slew;
+    if (!param_slew(context, slew, SCPI_UNIT_AMPER)) {
+        return SCPI_RES_ERR;
+    }
+    ridenScpi->ridenRamp.set_current_slew(slew);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceCurrentSlewQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    result_slew(context, ridenScpi->ridenRamp.get_current_slew());
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceVoltageTriggered(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    scpi_choice_def_t special;
+    scpi_number_t value;
+
+    if (!SCPI_ParamNumber(context, &special, &value, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    if (value.unit != SCPI_UNIT_NONE && value.unit != SCPI_UNIT_VOLT) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_TYPE_ERROR);
+        return SCPI_RES_ERR;
+    }
+    ridenScpi->ridenTrigger.set_voltage(value.content.value);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceVoltageTriggeredQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    if (ridenScpi->ridenTrigger.has_voltage()) {
+        SCPI_ResultDouble(context, ridenScpi->ridenTrigger.get_voltage());
+        return SCPI_RES_OK;
+    }
+    // Without a staged level the triggered level is the present level
+    return SourceVoltageQ(context);
+}
+
+scpi_result_t RidenScpi::SourceCurrentTriggered(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    scpi_choice_def_t special;
+    scpi_number_t value;
+
+    if (!SCPI_ParamNumber(context, &special, &value, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    if (value.unit != SCPI_UNIT_NONE && value.unit != SCPI_UNIT_AMPER) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_TYPE_ERROR);
+        return SCPI_RES_ERR;
+    }
+    ridenScpi->ridenTrigger.set_current(value.content.value);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceCurrentTriggeredQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    if (ridenScpi->ridenTrigger.has_current()) {
+        SCPI_ResultDouble(context, ridenScpi->ridenTrigger.get_current());
+        return SCPI_RES_OK;
+    }
+    return SourceCurrentQ(context);
+}
+
+scpi_result_t RidenScpi::TriggerSequenceSource(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    int32_t source;
+    if (!SCPI_ParamChoice(context, trigger_source_options, &source, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    ridenScpi->ridenTrigger.set_source((TriggerSource)source);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::TriggerSequenceSourceQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    SCPI_ResultChoice(context, trigger_source_options, (int32_t)ridenScpi->ridenTrigger.get_source());
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::TriggerSequenceTimer(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    scpi_choice_def_t special;
+    scpi_number_t value;
+
+    if (!SCPI_ParamNumber(context, &special, &value, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    if (value.unit != SCPI_UNIT_NONE && value.unit != SCPI_UNIT_SECOND) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_TYPE_ERROR);
+        return SCPI_RES_ERR;
+    }
+    if (value.content.value < 0 || value.content.value > 86400) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+        return SCPI_RES_ERR;
+    }
+    ridenScpi->ridenTrigger.set_timer_ms(lround(value.content.value * 1000));
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::TriggerSequenceTimerQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    SCPI_ResultDouble(context, ridenScpi->ridenTrigger.get_timer_ms() / 1000.0);
+    return SCPI_RES_OK;
+}
+
+/**
+ * Read a non-negative regulation target.
+ */
+static bool param_regulation_target(scpi_t *context, double &target, scpi_unit_t unit)
+{
+    scpi_choice_def_t special;
+    scpi_number_t value;
+    if (!SCPI_ParamNumber(context, &special, &value, TRUE)) {
+        return false;
+    }
+    if (value.unit != SCPI_UNIT_NONE && value.unit != unit) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_TYPE_ERROR);
+        return false;
+    }
+    if (value.content.value < 0) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+        return false;
+    }
+    target = value.content.value;
+    return true;
+}
+
+scpi_result_t RidenScpi::SourcePower(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    double power;
+    if (!param_regulation_target(context, power, SCPI_UNIT_WATT)) {
+        return SCPI_RES_ERR;
+    }
+    ridenScpi->ridenRegulator.set_power(power);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourcePowerQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    SCPI_ResultDouble(context, ridenScpi->ridenRegulator.get_power());
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceResistance(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    double resistance;
+    if (!param_regulation_target(context, resistance, SCPI_UNIT_OHM)) {
+        return SCPI_RES_ERR;
+    }
+    ridenScpi->ridenRegulator.set_resistance(resistance);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceResistanceQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    SCPI_ResultDouble(context, ridenScpi->ridenRegulator.get_resistance());
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceFunction(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    int32_t mode;
+    if (!SCPI_ParamChoice(context, function_options, &mode, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    if (mode != (int32_t)RegulationMode::Off) {
+        RidenSequencer &sequencer = ridenScpi->ridenSequencer;
+        RidenTrigger &trigger = ridenScpi->ridenTrigger;
+        if ((sequencer.is_running() && sequencer.is_voltage_list_mode()) || (trigger.is_armed() && trigger.has_voltage())) {
+            SCPI_ErrorPush(context, SCPI_ERROR_SETTINGS_CONFLICT);
+            return SCPI_RES_ERR;
+        }
+        // The regulator owns the voltage set point from now on
+        ridenScpi->ridenRamp.abort();
+    }
+    if (ridenScpi->ridenRegulator.set_mode((RegulationMode)mode)) {
+        return SCPI_RES_OK;
+    } else {
+        SCPI_ErrorPush(context, SCPI_ERROR_COMMAND);
+        return SCPI_RES_ERR;
+    }
+}
+
+scpi_result_t RidenScpi::SourceFunctionQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    SCPI_ResultChoice(context, function_options, (int32_t)ridenScpi->ridenRegulator.get_mode());
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceRegulationRateQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    SCPI_ResultDouble(context, ridenScpi->ridenRegulator.get_update_rate());
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SourceVoltageLimit(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    scpi_choice_def_t special;
+    scpi_number_t value;
+
+    if (!SCPI_ParamNumber(context, &special, &value, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    if (value.unit != SCPI_UNIT_NONE && value.unit != SCPI_UNIT_VOLT) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_TYPE_ERROR);
+        return SCPI_RES_ERR;
+    }
+    if (ridenScpi->ridenModbus.set_over_voltage_protection(value.content.value)) {
+        return SCPI_RES_OK;
+    } else {
+        SCPI_ErrorPush(context, SCPI_ERROR_COMMAND);
+        return SCPI_RES_ERR;
+    }
+}
+
+scpi_result_t RidenScpi::SourceCurrentLimit(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    scpi_choice_def_t special;
+    scpi_number_t value;
+
+    if (!SCPI_ParamNumber(context, &special, &value, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    if (value.unit != SCPI_UNIT_NONE && value.unit != SCPI_UNIT_AMPER) {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_TYPE_ERROR);
+        return SCPI_RES_ERR;
+    }
+    if (ridenScpi->ridenModbus.set_over_current_protection(value.content.value)) {
+        return SCPI_RES_OK;
+    } else {
+        SCPI_ErrorPush(context, SCPI_ERROR_COMMAND);
+        return SCPI_RES_ERR;
+    }
+}
+
+scpi_result_t RidenScpi::SystemBeeperState(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    bool on;
+    if (!SCPI_ParamBool(context, &on, TRUE)) {
+        return SCPI_RES_ERR;
+    }
+    if (ridenScpi->ridenModbus.set_buzzer_enabled(on)) {
+        return SCPI_RES_OK;
+    } else {
+        SCPI_ErrorPush(context, SCPI_ERROR_COMMAND);
+        return SCPI_RES_ERR;
+    }
+}
+
+scpi_result_t RidenScpi::SystemBeeperStateQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    bool on;
+    if (ridenScpi->ridenModbus.is_buzzer_enabled(on)) {
+        SCPI_ResultBool(context, on);
+        return SCPI_RES_OK;
+    } else {
+        SCPI_ErrorPush(context, SCPI_ERROR_COMMAND);
+        return SCPI_RES_ERR;
+    }
+}
+
+scpi_result_t RidenScpi::SystemLockRequestQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    ScpiSession *current_session = ridenScpi->current_session;
+    SCPI_ResultBool(context, current_session != nullptr && ridenScpi->request_lock(*current_session));
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SystemLockRelease(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    ScpiSession *current_session = ridenScpi->current_session;
+    if (current_session == nullptr || !ridenScpi->release_lock(*current_session)) {
+        SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+        return SCPI_RES_ERR;
+    }
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SystemLockOwnerQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    if (ridenScpi->lock_owner == nullptr) {
+        SCPI_ResultMnemonic(context, "NONE");
+    } else {
+        SCPI_ResultText(context, ridenScpi->lock_owner->ip.toString().c_str());
+    }
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SystemPerformanceQ(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    // Header, calls, parse, Modbus and total time in seconds for each executed command
+    for (uint16_t index = 0; index < ridenScpi->command_count; index++) {
+        const ScpiCommandProfile &profile = ridenScpi->command_profiles[index];
+        if (profile.calls == 0) {
+            continue;
+        }
+        SCPI_ResultText(context, scpi_commands[index].pattern);
+        SCPI_ResultUInt32(context, profile.calls);
+        SCPI_ResultDouble(context, profile.parse_us / 1e6);
+        SCPI_ResultDouble(context, profile.modbus_us / 1e6);
+        SCPI_ResultDouble(context, profile.total_us / 1e6);
+    }
+    return SCPI_RES_OK;
+}
+
+scpi_result_t RidenScpi::SystemPerformanceReset(scpi_t *context)
+{
+    RidenScpi *ridenScpi = static_cast<RidenScpi *>(context->user_context);
+
+    ridenScpi->reset_command_profiles();
+    return SCPI_RES_OK;
+}
+
+/**
+ * Whether every program message unit in a line is a query.
+ */
+static bool is_query_only(const char *data, size_t len)
+{
+    bool in_header = true;
+    bool has_header = false;
+    bool is_query = false;
+    char quote = 0;
+    for (size_t i = 0; i < len; i++) {
+        const char c = data[i];
+        if (quote != 0) {
+            if (c == quote) {
+                quote = 0;
+            }
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+        } else if (c == ';' || c == '\r' || c == '\n') {
+            if (has_header && !is_query) {
+                return false;
+            }
+            in_header = true;
+            has_header = false;
+            is_query = false;
+        } else if (in_header) {
+            if (isspace(c)) {
+                in_header = !has_header;
+            } else {
+                has_header = true;
+                is_query = (c == '?');
+            }
+        }
+    }
+    return !has_header || is_query;
+}
+
+/**
+ * @brief Write data to the parser and the device.
+ * It overwrites the data in the buffer from the raw socket server.
+ * 
+ * @param data data to be sent
+ * @param len length of data
+ */
+void RidenScpi::write(const char *data, size_t len) 
+{
+    if ((len == 0) || (data == NULL)) return;
+    // insert the data into the buffer.
+    if (len >= SCPI_INPUT_BUFFER_LENGTH) {
+        LOG_F("ERROR: RidenScpi buffer overflow. Ignoring data.\n");
+        return;
+    }
+    // A new command discards any response not read
+    clear_external_output();
+    memcpy(scpi_context.buffer.data, data, len);
+    external_control = true; // just to be sure
+    run_line(vxi_session, scpi_context.buffer.data, len);
+}
+
+/**
+ * @brief Read data from the parser and the device, this is the reaction to "write()"
+ *
+ * Responses larger than max_len are returned over several calls.
+ * 
+ * @param data buffer to copy the data into
+ * @param len length of data
+ * @param max_len maximum length of data
+ * @param end set to true when the last part of the response has been read
+ * @return scpi_result_t last error code
+ */
+scpi_result_t RidenScpi::read(char *data, size_t *len, size_t max_len, bool *end)
+{
+    if (!external_control || len == NULL || data == NULL || end == NULL) {
+        return SCPI_RES_ERR;
+    }
+    *len = 0;
+    *end = true;
+    if (!external_output_ready) {
+        return SCPI_RES_ERR;
+    }
+    size_t remaining = external_output_length - external_output_position;
+    *len = min(remaining, max_len);
+    memcpy(data, &external_output[external_output_position], *len);
+    external_output_position += *len;
+    if (external_output_position < external_output_length) {
+        *end = false;
+    } else {
+        clear_external_output();
+    }
+    return SCPI_RES_OK;
+}
+
+uint8_t RidenScpi::read_status_byte()
+{
+    update_status();
+    return SCPI_RegGet(&scpi_context, SCPI_REG_STB);
+}
+
+/**
+ * @brief Whether an operation started by a command is still in progress.
+ *
+ * Covers queued writes, slewing set points, a running LIST sequence
+ * and an armed trigger.
+ */
+bool RidenScpi::operations_pending()
+{
+    return ridenModbus.has_queued_writes()
+           || ridenRamp.is_voltage_ramping() || ridenRamp.is_current_ramping()
+           || ridenSequencer.is_running()
+           || ridenTrigger.is_armed();
+}
+
+/**
+ * @brief Hold back the *OPC? or *WAI being executed, and the input
+ * following it, while operations are pending.
+ *
+ * The session executes nothing more until operations_pending()
+ * clears, while other clients and the main loop carry on. The held
+ * back input then executes again, starting with the *OPC? or *WAI.
+ *
+ * @return true if the command was held back.
+ */
+bool RidenScpi::defer_until_complete(scpi_t *context)
+{
+    if (current_session == nullptr || !operations_pending()) {
+        return false;
+    }
+    deferred_at = context->param_list.cmd_raw.data;
+    return true;
+}
+
+/**
+ * @brief Mirror the power supply state into the condition registers.
+ *
+ * Bits that become set are also latched in the event registers,
+ * which in turn update the status byte and may request service.
+ */
+bool RidenScpi::update_status()
+{
+    Protection protection;
+    OutputMode output_mode;
+    bool output_on;
+    status_updated_at = millis();
+    if (!ridenModbus.get_status(protection, output_mode, output_on)) {
+        return false;
+    }
+
+    scpi_reg_val_t questionable = 0;
+    if (protection == Protection::OVP) {
+        questionable |= QUES_OVP_TRIPPED;
+    } else if (protection == Protection::OCP) {
+        questionable |= QUES_OCP_TRIPPED;
+    }
+    scpi_reg_val_t operation = 0;
+    if (!output_on) {
+        operation |= OPER_OUTPUT_OFF;
+    } else if (output_mode == OutputMode::CONSTANT_VOLTAGE) {
+        operation |= OPER_CONSTANT_VOLTAGE;
+    } else if (output_mode == OutputMode::CONSTANT_CURRENT) {
+        operation |= OPER_CONSTANT_CURRENT;
+    }
+
+    scpi_reg_val_t rising = questionable & ~SCPI_RegGet(&scpi_context, SCPI_REG_QUESC);
+    SCPI_RegSet(&scpi_context, SCPI_REG_QUESC, questionable);
+    if (rising) {
+        SCPI_RegSetBits(&scpi_context, SCPI_REG_QUES, rising);
+    }
+    rising = operation & ~SCPI_RegGet(&scpi_context, SCPI_REG_OPERC);
+    SCPI_RegSet(&scpi_context, SCPI_REG_OPERC, operation);
+    if (rising) {
+        SCPI_RegSetBits(&scpi_context, SCPI_REG_OPER, rising);
+    }
+    return true;
+}
+
+bool RidenScpi::begin()
+{
+    if (initialized) {
+        return true;
+    }
+
+    LOG_LN("RidenScpi initializing");
+
+    String type = ridenModbus.get_type();
+    uint32_t serial_number;
+    ridenModbus.get_serial_number(serial_number);
+    uint16_t firmware_version;
+    ridenModbus.get_firmware_version(firmware_version);
+    memcpy(idn2, type.c_str(), type.length());
+    sprintf(idn3, "%08u", serial_number);
+    sprintf(idn4, "%u.%u", firmware_version / 100u, firmware_version % 100u);
+
+    SCPI_Init(&scpi_context,
+              scpi_commands,
+              &scpi_interface,
+              scpi_units_def,
+              idn1, idn2, idn3, idn4,
+              scpi_input_buffer, SCPI_INPUT_BUFFER_LENGTH,
+              scpi_error_queue_data, SCPI_ERROR_QUEUE_SIZE);
+    scpi_context.user_context = this;
+    build_profiled_commands();
+    if (!state_store.begin()) {
+        LOG_LN("RidenScpi: *SAV unavailable");
+    }
+    if (!build_dispatch_index()) {
+        LOG_LN("RidenScpi: dispatch index unavailable, searching all commands");
+    }
+
+    // Start TCP listener
+    tcpServer.begin();
+    tcpServer.setNoDelay(true);
+
+    if (MDNS.isRunning()) {
+        LOG_LN("RidenScpi advertising as scpi-raw.");
+        auto scpi_service = MDNS.addService(NULL, "scpi-raw", "tcp", tcpServer.port());
+        MDNS.addServiceTxt(scpi_service, "version", SCPI_STD_VERSION_REVISION);
+    }
+
+    LOG_LN("RidenScpi initialized");
+
+    initialized = true;
+    return true;
+}
+
+bool RidenScpi::loop()
+{
+    if (external_control && vxi_session.is_waiting() && !operations_pending()) {
+        // The VXI server reads the response once it is complete
+        resume_line(vxi_session);
+    }
+
+    if (!ridenModbus.has_queued_writes() && ridenModbus.take_write_failure()) {
+        SCPI_ErrorPush(&scpi_context, SCPI_ERROR_EXECUTION_ERROR);
+    }
+    if (operation_complete_pending && !operations_pending()) {
+        SCPI_RegSetBits(&scpi_context, SCPI_REG_ESR, ESR_OPC);
+        operation_complete_pending = false;
+    }
+
+    // Follow the power supply only while someone listens for its events
+    if ((SCPI_RegGet(&scpi_context, SCPI_REG_QUESE) != 0 || SCPI_RegGet(&scpi_context, SCPI_REG_OPERE) != 0)
+        && millis() - status_updated_at >= SCPI_STATUS_INTERVAL_MS) {
+        update_status();
+    }
+
+    if (external_control) {
+        // skip this loop if I'm under external control
+        for (ScpiClient &scpi_client : clients) {
+            if (scpi_client.client && lock_owner != &scpi_client) {
+                LOG_LN("RidenScpi: disconnect client because I am under external control.");
+                stop_client(scpi_client);
+            }
+        }
+        return true;
+    }
+
+    // Check for new client connecting
+    WiFiClient newClient = tcpServer.accept();
+    if (newClient) {
+        LOG_LN("RidenScpi: New client.");
+        accept_client(newClient);
+    }
+
+    // Check for incoming data
+    for (ScpiClient &scpi_client : clients) {
+        if (scpi_client.client) {
+            read_input(scpi_client);
+        }
+    }
+
+    // Execute one line per client at a time, so a client sending
+    // a burst of commands does not hold up the other clients.
+    bool executed;
+    do {
+        executed = false;
+        for (uint8_t i = 0; i < SCPI_MAX_CLIENTS; i++) {
+            ScpiClient &scpi_client = clients[(next_client + i) % SCPI_MAX_CLIENTS];
+            if (scpi_client.client && execute_next_line(scpi_client)) {
+                executed = true;
+            }
+        }
+        next_client = (next_client + 1) % SCPI_MAX_CLIENTS;
+    } while (executed);
+
+    // Stop clients which disconnect
+    for (ScpiClient &scpi_client : clients) {
+        if (scpi_client.client && !scpi_client.client.connected()) {
+            LOG_LN("RidenScpi: disconnect client.");
+            stop_client(scpi_client);
+        }
+    }
+
+    return true;
+}
+
+uint16_t RidenScpi::port()
+{
+    return tcpServer.port();
+}
+
+std::list<IPAddress> RidenScpi::get_connected_clients()
+{
+    std::list<IPAddress> connected_clients;
+    for (ScpiClient &scpi_client : clients) {
+        if (scpi_client.client && scpi_client.client.connected()) {
+            connected_clients.push_back(scpi_client.client.remoteIP());
+        }
+    }
+    return connected_clients;
+}
+
+void RidenScpi::disconnect_client(const IPAddress &ip)
+{
+    for (ScpiClient &scpi_client : clients) {
+        if (scpi_client.client && scpi_client.client.connected() && scpi_client.client.remoteIP() == ip) {
+            stop_client(scpi_client);
+        }
+    }
+}
+
+void RidenScpi::accept_client(WiFiClient &new_client)
+{
+    if (!riden_access_control.is_allowed(new_client.remoteIP())) {
+        new_client.stop();
+        return;
+    }
+    for (ScpiClient &scpi_client : clients) {
+        if (!scpi_client.client) {
+            new_client.setNoDelay(true);
+            scpi_client.client = new_client;
+            scpi_client.ip = new_client.remoteIP();
+            scpi_client.input_length = 0;
+            return;
+        }
+    }
+    LOG_LN("RidenScpi: too many clients.");
+    new_client.stop();
+}
+
+void RidenScpi::stop_client(ScpiClient &scpi_client)
+{
+    scpi_client.client.stop();
+    scpi_client.input_length = 0;
+    end_session(scpi_client);
+}
+
+/**
+ * @brief Read the data available from a client into its input buffer.
+ *
+ * Data is only read while there is room in the buffer. Any
+ * remaining data is read once buffered lines have been executed.
+ */
+void RidenScpi::read_input(ScpiClient &scpi_client)
+{
+    int bytes_available = scpi_client.client.available();
+    while (bytes_available > 0) {
+        size_t space = SCPI_INPUT_BUFFER_LENGTH - scpi_client.input_length;
+        if (space == 0) {
+            if (memchr(scpi_client.input_buffer, '\n', scpi_client.input_length) == nullptr) {
+                // Client is sending more data than we can handle
+                LOG_F("ERROR: RidenScpi buffer overflow. Flushing data and killing connection.\n");
+                stop_client(scpi_client);
+            }
+            return;
+        }
+        int bytes_read = scpi_client.client.read((uint8_t *)&scpi_client.input_buffer[scpi_client.input_length], min(size_t(bytes_available), space));
+        if (bytes_read <= 0) {
+            return;
+        }
+        scpi_client.input_length += bytes_read;
+        bytes_available -= bytes_read;
+    }
+}
+
+/**
+ * @brief Execute the oldest complete line received from a client.
+ *
+ * @return true if a line was executed.
+ */
+bool RidenScpi::execute_next_line(ScpiClient &scpi_client)
+{
+    if (scpi_client.is_waiting()) {
+        if (operations_pending()) {
+            return false;
+        }
+        current_client = &scpi_client;
+        write_buffer_length = 0;
+        resume_line(scpi_client);
+        current_client = nullptr;
+        return true;
+    }
+
+    char *newline = static_cast<char *>(memchr(scpi_client.input_buffer, '\n', scpi_client.input_length));
+    if (newline == nullptr) {
+        return false;
+    }
+    size_t line_length = newline - scpi_client.input_buffer + 1;
+    LOG_F("RidenScpi: received %d bytes for handling\n", line_length);
+
+    current_client = &scpi_client;
+    if (!riden_access_control.consume(scpi_client.ip)) {
+        // Client exceeds its rate limit, so drop the command
+        SCPI_ErrorPush(&scpi_context, SCPI_ERROR_INIT_IGNORED);
+    } else {
+        write_buffer_length = 0;
+        run_line(scpi_client, scpi_client.input_buffer, line_length);
+    }
+    current_client = nullptr;
+
+    memmove(scpi_client.input_buffer, newline + 1, scpi_client.input_length - line_length);
+    scpi_client.input_length -= line_length;
+    return true;
+}
+
+size_t ScpiBufferedOutput::write(const char *data, size_t len)
+{
+    if (text.length() + len > EXTERNAL_OUTPUT_MAX_LENGTH) {
+        return 0;
+    }
+    text.concat(data, len);
+    return len;
+}
+
+/**
+ * @brief Execute a line received by another server, like the WebSocket endpoint.
+ *
+ * The response is written to output. The rate limit and SYSTem:LOCK
+ * apply as for raw socket clients, with session identifying the
+ * sender. Call end_session() when the connection closes.
+ */
+void RidenScpi::execute(ScpiSession &session, const char *data, size_t len, ScpiOutput &output)
+{
+    if (len >= SCPI_INPUT_BUFFER_LENGTH) {
+        SCPI_ErrorPush(&scpi_context, SCPI_ERROR_INPUT_BUFFER_OVERRUN);
+        return;
+    }
+    if (!riden_access_control.consume(session.ip)) {
+        SCPI_ErrorPush(&scpi_context, SCPI_ERROR_INIT_IGNORED);
+        return;
+    }
+    if (session.is_waiting()) {
+        // Executed by resume() after the input held back by *OPC? or *WAI
+        if (session.deferred.length() + len + 1 > SCPI_DEFERRED_INPUT_LENGTH) {
+            SCPI_ErrorPush(&scpi_context, SCPI_ERROR_INPUT_BUFFER_OVERRUN);
+            return;
+        }
+        if (!session.deferred.endsWith("\n")) {
+            session.deferred += '\n';
+        }
+        session.deferred.concat(data, len);
+        return;
+    }
+    memcpy(scpi_context.buffer.data, data, len);
+    current_output = &output;
+    run_line(session, scpi_context.buffer.data, len);
+    current_output = nullptr;
+}
+
+/**
+ * @brief Execute the input held back by *OPC? or *WAI once the
+ * pending operations have completed.
+ *
+ * Servers using execute() call this from their loop() while
+ * session.is_waiting().
+ *
+ * @return true if input was executed, with its response written to output.
+ */
+bool RidenScpi::resume(ScpiSession &session, ScpiOutput &output)
+{
+    if (!session.is_waiting() || operations_pending()) {
+        return false;
+    }
+    current_output = &output;
+    resume_line(session);
+    current_output = nullptr;
+    return true;
+}
+
+/**
+ * @brief Execute the input held back for session.
+ */
+void RidenScpi::resume_line(ScpiSession &session)
+{
+    String line = session.deferred;
+    session.deferred = "";
+    run_line(session, line.begin(), line.length());
+}
+
+/**
+ * @brief Parse a line from session, unless another session holds SYSTem:LOCK.
+ *
+ * Input held back by *OPC? or *WAI is kept in session.deferred.
+ */
+void RidenScpi::run_line(ScpiSession &session, char *data, size_t len)
+{
+    if (lock_owner != nullptr && lock_owner != &session && !is_query_only(data, len)) {
+        // Another client holds the lock
+        SCPI_ErrorPush(&scpi_context, SCPI_ERROR_COMMAND_PROTECTED);
+        return;
+    }
+    current_session = &session;
+    parse(data, len);
+    current_session = nullptr;
+    session.deferred = deferred_input;
+    deferred_input = "";
+}
+
+/**
+ * @brief Release what a closed connection holds, i.e. SYSTem:LOCK
+ * and any input held back.
+ */
+void RidenScpi::end_session(ScpiSession &session)
+{
+    session.deferred = "";
+    release_lock(session);
+}
+
+/**
+ * @brief Acquire SYSTem:LOCK for session.
+ *
+ * @return false if another session holds the lock.
+ */
+bool RidenScpi::request_lock(ScpiSession &session)
+{
+    if (&session == &vxi_session) {
+        // The VXI-11 link already holds the parser, see claim_external_control()
+        return false;
+    }
+    if (lock_owner != nullptr && lock_owner != &session) {
+        return false;
+    }
+    lock_owner = &session;
+    return true;
+}
+
+/**
+ * @brief Release SYSTem:LOCK held by session.
+ *
+ * @return false if session does not hold the lock.
+ */
+bool RidenScpi::release_lock(ScpiSession &session)
+{
+    if (lock_owner != &session) {
+        return false;
+    }
+    lock_owner = nullptr;
+    return true;
+}
+
+/**
+ * Key of the mnemonic at the start of a header.
+ *
+ * @return 0 if the mnemonic is shorter than three characters.
+ */
+static uint32_t mnemonic_key(const char *header, size_t len)
+{
+    uint32_t key = 0;
+    for (size_t i = 0; i < 3; i++) {
+        if (i >= len || !(isalpha(header[i]) || header[i] == '*')) {
+            return 0;
+        }
+        key = (key << 8) | toupper(header[i]);
+    }
+    return key;
+}
+
+/**
+ * Keys a command pattern may be reached by. A pattern with an
+ * optional root, like [SOURce]:VOLTage, is reached by both
+ * SOURce and VOLTage.
+ *
+ * @return The number of keys.
+ */
+static uint8_t pattern_keys(const char *pattern, uint32_t keys[2])
+{
+    size_t len = strlen(pattern);
+    if (pattern[0] != '[') {
+        keys[0] = mnemonic_key(pattern, len);
+        return 1;
+    }
+    keys[0] = mnemonic_key(pattern + 1, len - 1);
+    const char *end = strchr(pattern, ']');
+    if (end == nullptr || end[1] != ':') {
+        return 1;
+    }
+    keys[1] = mnemonic_key(end + 2, strlen(end + 2));
+    return 2;
+}
+
+ScpiDispatchGroup *RidenScpi::find_dispatch_group(uint32_t key, bool insert)
+{
+    if (key == 0) {
+        return nullptr;
+    }
+    for (uint8_t i = 0; i < SCPI_DISPATCH_BUCKETS; i++) {
+        ScpiDispatchGroup &group = dispatch_index[(key + i) % SCPI_DISPATCH_BUCKETS];
+        if (group.key == key) {
+            return &group;
+        }
+        if (group.key == 0) {
+            if (insert) {
+                group.key = key;
+                return &group;
+            }
+            return nullptr;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Copy scpi_commands with every callback replaced by ProfileCommand().
+ */
+void RidenScpi::build_profiled_commands()
+{
+    command_count = 0;
+    while (scpi_commands[command_count].pattern != nullptr) {
+        command_count++;
+    }
+    profiled_commands = new scpi_command_t[command_count + 1](); // Terminated by SCPI_CMD_LIST_END
+    command_profiles = new ScpiCommandProfile[command_count]();
+    for (uint16_t index = 0; index < command_count; index++) {
+        profiled_commands[index].pattern = scpi_commands[index].pattern;
+        profiled_commands[index].callback = RidenScpi::ProfileCommand;
+        profiled_commands[index].tag = index;
+    }
+}
+
+const scpi_command_t *RidenScpi::get_commands()
+{
+    return profiled_commands != nullptr ? profiled_commands : scpi_commands;
+}
+
+void RidenScpi::reset_command_profiles()
+{
+    for (uint16_t index = 0; index < command_count; index++) {
+        command_profiles[index] = {};
+    }
+}
+
+/**
+ * @brief Group scpi_commands by the first mnemonic of their header.
+ *
+ * Each group is a copy of its commands, in table order, terminated
+ * by SCPI_CMD_LIST_END so that it can be handed to the parser in
+ * place of the full table.
+ *
+ * @return false if the index could not be built.
+ */
+bool RidenScpi::build_dispatch_index()
+{
+    uint16_t total = 0;
+    for (const scpi_command_t *command = get_commands(); command->pattern != nullptr; command++) {
+        uint32_t keys[2];
+        uint8_t key_count = pattern_keys(command->pattern, keys);
+        for (uint8_t k = 0; k < key_count; k++) {
+            ScpiDispatchGroup *group = find_dispatch_group(keys[k], true);
+            if (group == nullptr) {
+                memset(dispatch_index, 0, sizeof(dispatch_index));
+                return false;
+            }
+            if (group->length == 0) {
+                total++; // Room for SCPI_CMD_LIST_END
+            }
+            group->length++;
+            total++;
+        }
+    }
+
+    dispatch_commands = new scpi_command_t[total]();
+    uint16_t offset = 0;
+    for (ScpiDispatchGroup &group : dispatch_index) {
+        if (group.key != 0) {
+            group.offset = offset;
+            offset += group.length + 1;
+            group.length = 0;
+        }
+    }
+    for (const scpi_command_t *command = get_commands(); command->pattern != nullptr; command++) {
+        uint32_t keys[2];
+        uint8_t key_count = pattern_keys(command->pattern, keys);
+        for (uint8_t k = 0; k < key_count; k++) {
+            ScpiDispatchGroup *group = find_dispatch_group(keys[k], false);
+            dispatch_commands[group->offset + group->length++] = *command;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Let the parser search only the commands that can match a line.
+ *
+ * Input with several program message units may use headers relative
+ * to the previous one, so it is matched against all commands.
+ */
+void RidenScpi::select_commands(const char *data, size_t len)
+{
+    scpi_context.cmdlist = get_commands();
+    if (dispatch_commands == nullptr) {
+        return;
+    }
+    const char *end = data + len;
+    while (data < end && (isspace(*data) || *data == ':')) {
+        data++;
+    }
+    while (end > data && isspace(end[-1])) {
+        end--;
+    }
+    if (memchr(data, ';', end - data) != nullptr || memchr(data, '\n', end - data) != nullptr) {
+        return;
+    }
+    ScpiDispatchGroup *group = find_dispatch_group(mnemonic_key(data, end - data), false);
+    if (group != nullptr) {
+        scpi_context.cmdlist = &dispatch_commands[group->offset];
+    }
+}
+
+ScpiMacro *RidenScpi::find_macro(const char *label, size_t len)
+{
+    for (ScpiMacro &macro : macros) {
+        if (strlen(macro.label) == len && strncasecmp(macro.label, label, len) == 0) {
+            return &macro;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Execute a program message, expanding a leading macro label.
+ *
+ * A macro label must be the first program message unit and takes no
+ * parameters. Its body is executed in place of the label, followed
+ * by the remaining program message units. Macros are not expanded
+ * within a macro body.
+ *
+ * Input from a *OPC? or *WAI that must wait for pending operations
+ * is skipped and left in deferred_input.
+ */
+void RidenScpi::parse(char *data, size_t len)
+{
+    if (macros_enabled) {
+        char *end = data + len;
+        char *label = data;
+        while (label < end && isspace(*label)) {
+            label++;
+        }
+        char *label_end = label;
+        while (label_end < end && !isspace(*label_end) && *label_end != ';') {
+            label_end++;
+        }
+        ScpiMacro *macro = find_macro(label, label_end - label);
+        if (macro != nullptr) {
+            char *rest = label_end;
+            while (rest < end && isspace(*rest)) {
+                rest++;
+            }
+            if (rest < end && *rest != ';') {
+                SCPI_ErrorPush(&scpi_context, SCPI_ERROR_PARAMETER_NOT_ALLOWED);
+                return;
+            }
+            select_commands(macro->body, macro->body_length);
+            parse_mark_us = micros();
+            SCPI_Parse(&scpi_context, macro->body, macro->body_length);
+            if (deferred_at != nullptr) {
+                // The rest of the body is held back with the rest of the line
+                deferred_input.concat(deferred_at, macro->body + macro->body_length - deferred_at);
+                deferred_input.concat(rest, end - rest);
+                deferred_at = nullptr;
+                return;
+            }
+            if (rest == end) {
+                return;
+            }
+            data = rest + 1;
+            len = end - data;
+        }
+    }
+    select_commands(data, len);
+    parse_mark_us = micros();
+    SCPI_Parse(&scpi_context, data, len);
+    if (deferred_at != nullptr) {
+        deferred_input.concat(deferred_at, data + len - deferred_at);
+        deferred_at = nullptr;
+    }
 }
 
 const char *RidenScpi::get_visa_resource()
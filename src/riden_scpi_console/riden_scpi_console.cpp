@@ -0,0 +1,274 @@
+// SPDX-FileCopyrightText: 2024 Peder Toftegaard Olsen
+//
+// SPDX-License-Identifier: MIT
+
+#include <riden_logging/riden_logging.h>
+#include <riden_scpi_console/riden_scpi_console.h>
+
+#include <Arduino.h>
+
+using namespace RidenDongle;
+
+// Telnet protocol, RFC 854 and RFC 857
+#define TELNET_SE 240
+#define TELNET_SB 250
+#define TELNET_WILL 251
+#define TELNET_WONT 252
+#define TELNET_DO 253
+#define TELNET_DONT 254
+#define TELNET_IAC 255
+#define TELNET_OPTION_ECHO 1
+#define TELNET_OPTION_SUPPRESS_GO_AHEAD 3
+
+#define KEY_CTRL_C 0x03
+#define KEY_BACKSPACE 0x08
+#define KEY_CTRL_U 0x15
+#define KEY_ESCAPE 0x1b
+#define KEY_DELETE 0x7f
+
+size_t ScpiConsoleOutput::write(const char *data, size_t len)
+{
+    // Telnet expects CR LF at the end of a line
+    size_t start = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == '\n' && (i == 0 || data[i - 1] != '\r')) {
+            client.write(&data[start], i - start);
+            client.write("\r\n", 2);
+            start = i + 1;
+        }
+    }
+    client.write(&data[start], len - start);
+    return len;
+}
+
+bool RidenScpiConsole::begin()
+{
+    if (initialized) {
+        return true;
+    }
+
+    LOG_LN("RidenScpiConsole initializing");
+
+    tcpServer.begin();
+    tcpServer.setNoDelay(true);
+
+    LOG_LN("RidenScpiConsole initialized");
+
+    initialized = true;
+    return true;
+}
+
+bool RidenScpiConsole::loop()
+{
+    if (!initialized) {
+        return false;
+    }
+
+    WiFiClient new_client = tcpServer.accept();
+    if (new_client) {
+        accept_client(new_client);
+    }
+
+    if (client && !client.connected()) {
+        LOG_LN("RidenScpiConsole: disconnect client.");
+        client.stop();
+        ridenScpi.end_session(session);
+    }
+    if (client && session.is_waiting()) {
+        // Input held back by *OPC? or *WAI
+        ScpiConsoleOutput output(client);
+        if (ridenScpi.resume(session, output) && !session.is_waiting()) {
+            send_prompt();
+        }
+    }
+    while (client && !session.is_waiting() && client.available() > 0) {
+        int c = client.read();
+        if (c < 0) {
+            break;
+        }
+        handle_input(c);
+    }
+    return true;
+}
+
+uint16_t RidenScpiConsole::port()
+{
+    return tcpServer.port();
+}
+
+void RidenScpiConsole::accept_client(WiFiClient &new_client)
+{
+    if (!riden_access_control.is_allowed(new_client.remoteIP())) {
+        new_client.stop();
+        return;
+    }
+    if (client && client.connected()) {
+        LOG_LN("RidenScpiConsole: too many clients.");
+        new_client.print("Console in use\r\n");
+        new_client.stop();
+        return;
+    }
+    LOG_LN("RidenScpiConsole: New client.");
+    ridenScpi.end_session(session);
+    client = new_client;
+    client.setNoDelay(true);
+    session.ip = client.remoteIP();
+    line_length = 0;
+    history_position = history_length;
+    input_state = InputState::Normal;
+    skip_newline = false;
+
+    // Echo input ourselves and let the client send characters as they are typed
+    const uint8_t negotiation[] = {
+        TELNET_IAC, TELNET_WILL, TELNET_OPTION_ECHO,
+        TELNET_IAC, TELNET_WILL, TELNET_OPTION_SUPPRESS_GO_AHEAD,
+    };
+    client.write(negotiation, sizeof(negotiation));
+    client.print("Riden Dongle SCPI console\r\n");
+    send_prompt();
+}
+
+void RidenScpiConsole::handle_input(uint8_t c)
+{
+    switch (input_state) {
+    case InputState::Iac:
+        if (c == TELNET_WILL || c == TELNET_WONT || c == TELNET_DO || c == TELNET_DONT) {
+            input_state = InputState::IacOption;
+        } else if (c == TELNET_SB) {
+            input_state = InputState::Subnegotiation;
+        } else {
+            input_state = InputState::Normal;
+        }
+        return;
+    case InputState::IacOption:
+        input_state = InputState::Normal;
+        return;
+    case InputState::Subnegotiation:
+        if (c == TELNET_IAC) {
+            input_state = InputState::SubnegotiationIac;
+        }
+        return;
+    case InputState::SubnegotiationIac:
+        input_state = c == TELNET_SE ? InputState::Normal : InputState::Subnegotiation;
+        return;
+    case InputState::Escape:
+        input_state = c == '[' ? InputState::EscapeSequence : InputState::Normal;
+        return;
+    case InputState::EscapeSequence:
+        if (c >= 0x40 && c <= 0x7e) {
+            input_state = InputState::Normal;
+            if (c == 'A' && history_position > 0) {
+                recall_history(history_position - 1);
+            } else if (c == 'B' && history_position < history_length) {
+                recall_history(history_position + 1);
+            }
+        }
+        return;
+    case InputState::Normal:
+        break;
+    }
+
+    if (skip_newline) {
+        skip_newline = false;
+        if (c == '\n' || c == '\0') {
+            return;
+        }
+    }
+    switch (c) {
+    case TELNET_IAC:
+        input_state = InputState::Iac;
+        break;
+    case KEY_ESCAPE:
+        input_state = InputState::Escape;
+        break;
+    case '\r':
+        skip_newline = true;
+        execute_line();
+        break;
+    case '\n':
+        execute_line();
+        break;
+    case KEY_BACKSPACE:
+    case KEY_DELETE:
+        if (line_length > 0) {
+            line_length--;
+            client.write("\b \b", 3);
+        }
+        break;
+    case KEY_CTRL_C:
+    case KEY_CTRL_U:
+        replace_line("", 0);
+        history_position = history_length;
+        break;
+    default:
+        if (isprint(c) && line_length < sizeof(line) - 1) {
+            line[line_length++] = c;
+            client.write(c);
+        }
+        break;
+    }
+}
+
+void RidenScpiConsole::execute_line()
+{
+    client.write("\r\n", 2);
+    if (line_length > 0) {
+        add_to_history();
+        ScpiConsoleOutput output(client);
+        ridenScpi.execute(session, line, line_length, output);
+    }
+    line_length = 0;
+    history_position = history_length;
+    if (!session.is_waiting()) {
+        send_prompt();
+    }
+}
+
+void RidenScpiConsole::add_to_history()
+{
+    uint8_t last = (history_start + history_length - 1) % SCPI_CONSOLE_HISTORY_LENGTH;
+    if (history_length > 0 && strlen(history[last]) == line_length && strncmp(history[last], line, line_length) == 0) {
+        // Do not repeat the same line
+        return;
+    }
+    uint8_t index;
+    if (history_length < SCPI_CONSOLE_HISTORY_LENGTH) {
+        index = (history_start + history_length) % SCPI_CONSOLE_HISTORY_LENGTH;
+        history_length++;
+    } else {
+        index = history_start;
+        history_start = (history_start + 1) % SCPI_CONSOLE_HISTORY_LENGTH;
+    }
+    memcpy(history[index], line, line_length);
+    history[index][line_length] = '\0';
+}
+
+/**
+ * @brief Show a line from the history, or an empty line past the newest.
+ */
+void RidenScpiConsole::recall_history(uint8_t position)
+{
+    history_position = position;
+    if (position == history_length) {
+        replace_line("", 0);
+        return;
+    }
+    const char *text = history[(history_start + position) % SCPI_CONSOLE_HISTORY_LENGTH];
+    replace_line(text, strlen(text));
+}
+
+void RidenScpiConsole::replace_line(const char *text, size_t len)
+{
+    // Move to the start of the line, rewrite it and erase what remains
+    client.write('\r');
+    client.print(SCPI_CONSOLE_PROMPT);
+    client.write(text, len);
+    client.print("\x1b[K");
+    memcpy(line, text, len);
+    line_length = len;
+}
+
+void RidenScpiConsole::send_prompt()
+{
+    client.print(SCPI_CONSOLE_PROMPT);
+}
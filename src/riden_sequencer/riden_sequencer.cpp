@@ -0,0 +1,146 @@
+// SPDX-FileCopyrightText: 2024 Peder Toftegaard Olsen
+//
+// SPDX-License-Identifier: MIT
+
+#include <riden_logging/riden_logging.h>
+#include <riden_sequencer/riden_sequencer.h>
+
+#include <Arduino.h>
+
+using namespace RidenDongle;
+
+/**
+ * Value of a list at step, where a single value applies to all steps.
+ */
+template <typename T>
+static T list_value(const T *values, uint8_t count, uint8_t step)
+{
+    return values[(count == 1) ? 0 : step];
+}
+
+bool RidenSequencer::begin()
+{
+    if (initialized) {
+        return true;
+    }
+
+    LOG_LN("RidenSequencer initializing");
+    LOG_LN("RidenSequencer initialized");
+
+    initialized = true;
+    return true;
+}
+
+bool RidenSequencer::loop()
+{
+    if (!initialized) {
+        return false;
+    }
+    if (!running) {
+        return true;
+    }
+
+    if (!step_applied) {
+        // Retried on the next call if the power supply did not respond
+        step_applied = apply_step();
+        return true;
+    }
+
+    // Dwell times are measured from when a step was due, so a
+    // slow Modbus transaction does not delay the following steps.
+    const uint32_t dwell_ms = list_value(dwells_ms, dwell_count, step);
+    if (millis() - step_started_at < dwell_ms) {
+        return true;
+    }
+    step_started_at += dwell_ms;
+    step++;
+    if (step >= steps) {
+        step = 0;
+        repetition++;
+        if (count != 0 && repetition >= count) {
+            LOG_LN("RidenSequencer: done");
+            running = false;
+            return true;
+        }
+    }
+    step_applied = false;
+    return true;
+}
+
+bool RidenSequencer::set_voltages(const double *voltages, uint8_t count)
+{
+    if (count > SEQUENCER_MAX_POINTS) {
+        return false;
+    }
+    memcpy(this->voltages, voltages, count * sizeof(double));
+    voltage_count = count;
+    return true;
+}
+
+bool RidenSequencer::set_currents(const double *currents, uint8_t count)
+{
+    if (count > SEQUENCER_MAX_POINTS) {
+        return false;
+    }
+    memcpy(this->currents, currents, count * sizeof(double));
+    current_count = count;
+    return true;
+}
+
+bool RidenSequencer::set_dwells_ms(const uint32_t *dwells_ms, uint8_t count)
+{
+    if (count > SEQUENCER_MAX_POINTS) {
+        return false;
+    }
+    memcpy(this->dwells_ms, dwells_ms, count * sizeof(uint32_t));
+    dwell_count = count;
+    return true;
+}
+
+bool RidenSequencer::start()
+{
+    if ((!voltage_list_mode && !current_list_mode) || dwell_count == 0) {
+        return false;
+    }
+    if ((voltage_list_mode && voltage_count == 0) || (current_list_mode && current_count == 0)) {
+        return false;
+    }
+
+    steps = dwell_count;
+    if (voltage_list_mode) {
+        steps = max(steps, voltage_count);
+    }
+    if (current_list_mode) {
+        steps = max(steps, current_count);
+    }
+    if ((dwell_count != 1 && dwell_count != steps) ||
+        (voltage_list_mode && voltage_count != 1 && voltage_count != steps) ||
+        (current_list_mode && current_count != 1 && current_count != steps)) {
+        return false;
+    }
+
+    LOG_F("RidenSequencer: running %u steps\r\n", steps);
+    step = 0;
+    repetition = 0;
+    step_applied = false;
+    step_started_at = millis();
+    running = true;
+    return true;
+}
+
+void RidenSequencer::abort()
+{
+    running = false;
+}
+
+bool RidenSequencer::apply_step()
+{
+    if (voltage_list_mode && current_list_mode) {
+        return riden_modbus.set_voltage_and_current_set(list_value(voltages, voltage_count, step),
+                                                        list_value(currents, current_count, step));
+    } else if (voltage_list_mode) {
+        return riden_modbus.set_voltage_set(list_value(voltages, voltage_count, step));
+    } else {
+        return riden_modbus.set_current_set(list_value(currents, current_count, step));
+    }
+}
@@ -0,0 +1,165 @@
+// SPDX-FileCopyrightText: 2024 Peder Toftegaard Olsen
+//
+// SPDX-License-Identifier: MIT
+
+#include <riden_logging/riden_logging.h>
+#include <riden_state_store/riden_state_store.h>
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+using namespace RidenDongle;
+
+bool RidenStateStore::begin()
+{
+    if (initialized) {
+        return true;
+    }
+
+    LOG_LN("RidenStateStore initializing");
+
+    if (!LittleFS.begin()) {
+        LOG_LN("RidenStateStore: failed to mount LittleFS");
+        return false;
+    }
+
+    LOG_LN("RidenStateStore initialized");
+    initialized = true;
+    return true;
+}
+
+bool RidenStateStore::set_over_voltage_protection(double voltage)
+{
+    if (!riden_modbus.set_over_voltage_protection(voltage)) {
+        // The power supply may or may not have taken it
+        over_voltage_protection = NAN;
+        return false;
+    }
+    over_voltage_protection = voltage;
+    return true;
+}
+
+bool RidenStateStore::get_over_voltage_protection(double &voltage)
+{
+    voltage = over_voltage_protection;
+    return !isnan(voltage);
+}
+
+bool RidenStateStore::set_over_current_protection(double current)
+{
+    if (!riden_modbus.set_over_current_protection(current)) {
+        over_current_protection = NAN;
+        return false;
+    }
+    over_current_protection = current;
+    return true;
+}
+
+bool RidenStateStore::get_over_current_protection(double &current)
+{
+    current = over_current_protection;
+    return !isnan(current);
+}
+
+bool RidenStateStore::save(uint8_t index)
+{
+    if (!initialized || index < 1 || index > NUMBER_OF_PRESETS) {
+        return false;
+    }
+
+    // The OVP and OCP in effect cannot be read back, see README
+    Preset preset;
+    if (!get_over_voltage_protection(preset.over_voltage_protection)
+        || !get_over_current_protection(preset.over_current_protection)) {
+        return false;
+    }
+    if (!riden_modbus.get_voltage_set(preset.voltage)
+        || !riden_modbus.get_current_set(preset.current)) {
+        return false;
+    }
+    StoredState state = {};
+    state.magic = STATE_STORE_MAGIC;
+    state.version = STATE_STORE_VERSION;
+    if (!riden_modbus.get_output_on(state.output_on)) {
+        return false;
+    }
+    state.voltage_slew = riden_ramp.get_voltage_slew();
+    state.current_slew = riden_ramp.get_current_slew();
+    state.voltage_list_mode = riden_sequencer.is_voltage_list_mode();
+    state.current_list_mode = riden_sequencer.is_current_list_mode();
+    state.count = riden_sequencer.get_count();
+    state.voltage_count = riden_sequencer.get_voltage_count();
+    memcpy(state.voltages, riden_sequencer.get_voltages(), state.voltage_count * sizeof(double));
+    state.current_count = riden_sequencer.get_current_count();
+    memcpy(state.currents, riden_sequencer.get_currents(), state.current_count * sizeof(double));
+    state.dwell_count = riden_sequencer.get_dwell_count();
+    memcpy(state.dwells_ms, riden_sequencer.get_dwells_ms(), state.dwell_count * sizeof(uint32_t));
+
+    if (!riden_modbus.set_preset(index, preset)) {
+        return false;
+    }
+
+    char path[16];
+    get_path(path, index);
+    File file = LittleFS.open(path, "w");
+    if (!file) {
+        LOG_F("RidenStateStore: failed to open %s\n", path);
+        return false;
+    }
+    bool success = file.write((const uint8_t *)&state, sizeof(state)) == sizeof(state);
+    file.close();
+    return success;
+}
+
+bool RidenStateStore::recall(uint8_t index)
+{
+    if (index < 1 || index > NUMBER_OF_PRESETS) {
+        return false;
+    }
+
+    StoredState state = {};
+    bool has_state = false;
+    if (initialized) {
+        char path[16];
+        get_path(path, index);
+        File file = LittleFS.open(path, "r");
+        if (file) {
+            has_state = file.read((uint8_t *)&state, sizeof(state)) == sizeof(state)
+                        && state.magic == STATE_STORE_MAGIC
+                        && state.version == STATE_STORE_VERSION;
+            file.close();
+        }
+    }
+
+    // Applies voltage, current, OVP and OCP in one transaction
+    over_voltage_protection = NAN;
+    over_current_protection = NAN;
+    if (!riden_modbus.set_preset(index)) {
+        return false;
+    }
+    Preset preset;
+    if (riden_modbus.get_preset(index, preset)) {
+        over_voltage_protection = preset.over_voltage_protection;
+        over_current_protection = preset.over_current_protection;
+    }
+    if (!has_state) {
+        return true;
+    }
+
+    riden_ramp.abort();
+    riden_ramp.set_voltage_slew(state.voltage_slew);
+    riden_ramp.set_current_slew(state.current_slew);
+    riden_sequencer.abort();
+    riden_sequencer.set_voltage_list_mode(state.voltage_list_mode);
+    riden_sequencer.set_current_list_mode(state.current_list_mode);
+    riden_sequencer.set_count(state.count);
+    riden_sequencer.set_voltages(state.voltages, min(state.voltage_count, uint8_t(SEQUENCER_MAX_POINTS)));
+    riden_sequencer.set_currents(state.currents, min(state.current_count, uint8_t(SEQUENCER_MAX_POINTS)));
+    riden_sequencer.set_dwells_ms(state.dwells_ms, min(state.dwell_count, uint8_t(SEQUENCER_MAX_POINTS)));
+    return riden_modbus.set_output_on(state.output_on);
+}
+
+void RidenStateStore::get_path(char *path, uint8_t index)
+{
+    sprintf(path, "/state%u.bin", index);
+}
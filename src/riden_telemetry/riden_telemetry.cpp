@@ -0,0 +1,101 @@
+// SPDX-FileCopyrightText: 2024 Peder Toftegaard Olsen
+//
+// SPDX-License-Identifier: MIT
+
+#include <riden_logging/riden_logging.h>
+#include <riden_telemetry/riden_telemetry.h>
+
+#include <Arduino.h>
+
+using namespace RidenDongle;
+
+static void update_range(TelemetryRange &range, double value, bool first)
+{
+    if (first || value < range.min) {
+        range.min = value;
+    }
+    if (first || value > range.max) {
+        range.max = value;
+    }
+}
+
+bool RidenTelemetry::begin()
+{
+    if (initialized) {
+        return true;
+    }
+
+    LOG_LN("RidenTelemetry initializing");
+
+    next_sample_at = millis();
+    window_started_at = next_sample_at;
+
+    LOG_LN("RidenTelemetry initialized");
+    initialized = true;
+    return true;
+}
+
+bool RidenTelemetry::loop()
+{
+    if (!initialized) {
+        return false;
+    }
+
+    unsigned long now = millis();
+    if (long(now - next_sample_at) < 0) {
+        return true;
+    }
+    next_sample_at += TELEMETRY_INTERVAL_MS;
+    if (long(now - next_sample_at) >= 0) {
+        // We fell behind, so do not try to catch up
+        next_sample_at = now + TELEMETRY_INTERVAL_MS;
+    }
+
+    TelemetrySample sample;
+    if (!riden_modbus.get_output_values(sample.voltage, sample.current, sample.power)) {
+        return true;
+    }
+    sample.timestamp = millis();
+    add_sample(sample);
+
+    if (sample.timestamp - window_started_at >= TELEMETRY_WINDOW_MS) {
+        close_window();
+        window_started_at = sample.timestamp;
+    }
+    return true;
+}
+
+void RidenTelemetry::add_sample(const TelemetrySample &sample)
+{
+    if (sample_count > 0) {
+        // Trapezoidal integration between the previous and this sample
+        double hours = double(sample.timestamp - latest_sample.timestamp) / 3600000.0;
+        energy_wh += hours * (latest_sample.power + sample.power) / 2.0;
+    }
+    latest_sample = sample;
+    sample_count++;
+
+    bool first = current_window.samples == 0;
+    update_range(current_window.voltage, sample.voltage, first);
+    update_range(current_window.current, sample.current, first);
+    update_range(current_window.power, sample.power, first);
+    voltage_sum += sample.voltage;
+    current_sum += sample.current;
+    power_sum += sample.power;
+    current_window.samples++;
+}
+
+void RidenTelemetry::close_window()
+{
+    if (current_window.samples > 0) {
+        current_window.voltage.avg = voltage_sum / current_window.samples;
+        current_window.current.avg = current_sum / current_window.samples;
+        current_window.power.avg = power_sum / current_window.samples;
+    }
+    last_window = current_window;
+
+    current_window = {};
+    voltage_sum = 0;
+    current_sum = 0;
+    power_sum = 0;
+}
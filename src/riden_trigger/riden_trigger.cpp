@@ -0,0 +1,99 @@
+// SPDX-FileCopyrightText: 2024 Peder Toftegaard Olsen
+//
+// SPDX-License-Identifier: MIT
+
+#include <riden_logging/riden_logging.h>
+#include <riden_trigger/riden_trigger.h>
+
+#include <Arduino.h>
+
+using namespace RidenDongle;
+
+bool RidenTrigger::begin()
+{
+    if (initialized) {
+        return true;
+    }
+
+    LOG_LN("RidenTrigger initializing");
+    LOG_LN("RidenTrigger initialized");
+
+    initialized = true;
+    return true;
+}
+
+bool RidenTrigger::loop()
+{
+    if (!initialized) {
+        return false;
+    }
+    if (!armed) {
+        return true;
+    }
+
+    if (fired || (source == TriggerSource::Timer && millis() - armed_at >= timer_ms)) {
+        // Retried on the next call if the power supply did not respond
+        fire();
+    }
+    return true;
+}
+
+void RidenTrigger::set_voltage(double voltage)
+{
+    this->voltage = voltage;
+    voltage_staged = true;
+}
+
+void RidenTrigger::set_current(double current)
+{
+    this->current = current;
+    current_staged = true;
+}
+
+bool RidenTrigger::arm()
+{
+    if (!voltage_staged && !current_staged) {
+        return false;
+    }
+    armed = true;
+    fired = false;
+    armed_at = millis();
+    if (source == TriggerSource::Immediate) {
+        fire();
+    }
+    return true;
+}
+
+bool RidenTrigger::trigger()
+{
+    if (!armed || source != TriggerSource::Bus) {
+        return false;
+    }
+    fire();
+    return true;
+}
+
+void RidenTrigger::fire()
+{
+    fired = true;
+    if (apply()) {
+        armed = false;
+    }
+}
+
+bool RidenTrigger::apply()
+{
+    bool success;
+    if (voltage_staged && current_staged) {
+        success = riden_modbus.set_voltage_and_current_set(voltage, current);
+    } else if (voltage_staged) {
+        success = riden_modbus.set_voltage_set(voltage);
+    } else {
+        success = riden_modbus.set_current_set(current);
+    }
+    if (success) {
+        voltage_staged = false;
+        current_staged = false;
+    }
+    return success;
+}
@@ -12,9 +12,9 @@ class SCPI_handler: public SCPI_handler_interface
     {
         ridenScpi.write(data, len);
     }
-    scpi_result_t read(char *data, size_t *len, size_t max_len) override
+    scpi_result_t read(char *data, size_t *len, size_t max_len, bool *end) override
     {
-        return ridenScpi.read(data, len, max_len);
+        return ridenScpi.read(data, len, max_len, end);
     }
     bool claim_control() override
     {
@@ -24,9 +24,25 @@ class SCPI_handler: public SCPI_handler_interface
     {
         ridenScpi.release_external_control();
     }
+    uint8_t read_status_byte() override
+    {
+        return ridenScpi.read_status_byte();
+    }
+    bool is_busy() override
+    {
+        return ridenScpi.is_external_control_waiting();
+    }
+    bool take_service_request() override
+    {
+        uint32_t count = ridenScpi.get_service_request_count();
+        bool result = count != service_requests_seen;
+        service_requests_seen = count;
+        return result;
+    }
 
   private:
   RidenDongle::RidenScpi &ridenScpi;
+  uint32_t service_requests_seen = 0;
 };
 
 
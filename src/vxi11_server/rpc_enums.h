@@ -97,8 +97,9 @@ enum rpc_status {
 */
 enum programs {
 
-    PORTMAP = 0x186A0,    ///< Request for the port on which the VXI_Server is listening
-    VXI_11_CORE = 0x607AF ///< Request for a VXI command to be executed
+    PORTMAP = 0x186A0,     ///< Request for the port on which the VXI_Server is listening
+    VXI_11_CORE = 0x607AF, ///< Request for a VXI command to be executed
+    VXI_11_INTR = 0x607B1  ///< Service requests sent by the VXI_Server to the client
 };
 
 /*!
@@ -106,11 +107,16 @@ enum programs {
 */
 enum procedures {
 
-    GET_PORT = 3,            ///< Return the port on which the VXI_Server is currently listening
-    VXI_11_CREATE_LINK = 10, ///< Create a link to handle a series of requests
-    VXI_11_DEV_WRITE = 11,   ///< Write to the AWG
-    VXI_11_DEV_READ = 12,    ///< Read from the AWG
-    VXI_11_DESTROY_LINK = 23 ///< Destroy the link and cycle to the next port
+    GET_PORT = 3,                  ///< Return the port on which the VXI_Server is currently listening
+    VXI_11_CREATE_LINK = 10,       ///< Create a link to handle a series of requests
+    VXI_11_DEV_WRITE = 11,         ///< Write to the AWG
+    VXI_11_DEV_READ = 12,          ///< Read from the AWG
+    VXI_11_DEV_READSTB = 13,       ///< Read the status byte
+    VXI_11_DEV_ENABLE_SRQ = 20,    ///< Enable or disable service requests
+    VXI_11_DESTROY_LINK = 23,      ///< Destroy the link and cycle to the next port
+    VXI_11_CREATE_INTR_CHAN = 25,  ///< Create the channel used for service requests
+    VXI_11_DESTROY_INTR_CHAN = 26, ///< Destroy the channel used for service requests
+    VXI_11_INTR_SRQ = 30           ///< Service request sent on the interrupt channel
 };
 
 /*!
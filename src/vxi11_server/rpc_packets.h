@@ -354,6 +354,110 @@ struct write_response_packet {
     big_endian_32_t size;        ///< Number of bytes sent
 };
 
+/*!
+  @brief  Structure of a VXI_11 response packet carrying only an error.
+
+  In addition to the basic RPC response data, this response includes
+  an error field. It is used for DEV_ENABLE_SRQ, CREATE_INTR_CHAN and
+  DESTROY_INTR_CHAN.
+*/
+struct error_response_packet {
+    big_endian_32_t xid;         ///< Transaction id (we just pass it back what we received in the request)
+    big_endian_32_t msg_type;    ///< Message type (see rpc::msg_type)
+    big_endian_32_t reply_state; ///< Accepted or rejected (see rpc::reply_state)
+    big_endian_32_t verifier_l;  ///< Security data (not used in this context)
+    big_endian_32_t verifier_h;  ///< Security data (not used in this context)
+    big_endian_32_t rpc_status;  ///< Status of accepted message (see rpc::rpc_status)
+    big_endian_32_t error;       ///< Error code (see rpc::errors)
+};
+
+/*!
+  @brief  Structure of the VXI_11_DEV_READSTB response packet.
+
+  In addition to the basic RPC response data, the DEV_READSTB response
+  includes an error field and the status byte.
+*/
+struct readstb_response_packet {
+    big_endian_32_t xid;         ///< Transaction id (we just pass it back what we received in the request)
+    big_endian_32_t msg_type;    ///< Message type (see rpc::msg_type)
+    big_endian_32_t reply_state; ///< Accepted or rejected (see rpc::reply_state)
+    big_endian_32_t verifier_l;  ///< Security data (not used in this context)
+    big_endian_32_t verifier_h;  ///< Security data (not used in this context)
+    big_endian_32_t rpc_status;  ///< Status of accepted message (see rpc::rpc_status)
+    big_endian_32_t error;       ///< Error code (see rpc::errors)
+    big_endian_32_t stb;         ///< The status byte
+};
+
+/*!
+  @brief  Structure of the VXI_11_DEV_ENABLE_SRQ request packet.
+
+  In addition to the basic RPC request data, the DEV_ENABLE_SRQ request
+  includes the link id, whether service requests are enabled, and a
+  handle to pass back with each service request.
+*/
+struct enable_srq_request_packet {
+    big_endian_32_t xid;             ///< Transaction id (should be checked to make sure it matches, but we will just pass it back)
+    big_endian_32_t msg_type;        ///< Message type (see rpc::msg_type)
+    big_endian_32_t rpc_version;     ///< RPC protocol version (should be 2, but we can ignore)
+    big_endian_32_t program;         ///< Program code (see rpc::programs)
+    big_endian_32_t program_version; ///< Program version - what version of the program is requested (we can ignore)
+    big_endian_32_t procedure;       ///< Procedure code (see rpc::procedures)
+    big_endian_32_t credentials_l;   ///< Security data (not used in this context)
+    big_endian_32_t credentials_h;   ///< Security data (not used in this context)
+    big_endian_32_t verifier_l;      ///< Security data (not used in this context)
+    big_endian_32_t verifier_h;      ///< Security data (not used in this context)
+    big_endian_32_t link_id;         ///< Unique link id generated for this session (see CREATE_LINK)
+    big_endian_32_t enable;          ///< Non-zero to enable service requests
+    big_endian_32_t handle_len;      ///< Length of the handle (at most 40)
+    char handle[];                   ///< The handle
+};
+
+/*!
+  @brief  Structure of the VXI_11_CREATE_INTR_CHAN request packet.
+
+  In addition to the basic RPC request data, the CREATE_INTR_CHAN request
+  includes the address, port and program of the client's interrupt server.
+*/
+struct create_intr_chan_request_packet {
+    big_endian_32_t xid;             ///< Transaction id (should be checked to make sure it matches, but we will just pass it back)
+    big_endian_32_t msg_type;        ///< Message type (see rpc::msg_type)
+    big_endian_32_t rpc_version;     ///< RPC protocol version (should be 2, but we can ignore)
+    big_endian_32_t program;         ///< Program code (see rpc::programs)
+    big_endian_32_t program_version; ///< Program version - what version of the program is requested (we can ignore)
+    big_endian_32_t procedure;       ///< Procedure code (see rpc::procedures)
+    big_endian_32_t credentials_l;   ///< Security data (not used in this context)
+    big_endian_32_t credentials_h;   ///< Security data (not used in this context)
+    big_endian_32_t verifier_l;      ///< Security data (not used in this context)
+    big_endian_32_t verifier_h;      ///< Security data (not used in this context)
+    big_endian_32_t host_addr;       ///< IPv4 address of the interrupt server
+    big_endian_32_t host_port;       ///< Port of the interrupt server
+    big_endian_32_t prog_num;        ///< Program number of the interrupt server (should be VXI_11_INTR)
+    big_endian_32_t prog_vers;       ///< Program version of the interrupt server (should be 1)
+    big_endian_32_t prog_family;     ///< 0 for TCP, 1 for UDP (only TCP is supported)
+};
+
+/*!
+  @brief  Structure of the VXI_11_INTR_SRQ request packet.
+
+  Unlike the other requests, this one is sent by the VXI_Server to the
+  client's interrupt server. It passes back the handle supplied with
+  DEV_ENABLE_SRQ.
+*/
+struct intr_srq_request_packet {
+    big_endian_32_t xid;             ///< Transaction id (should be checked to make sure it matches, but we will just pass it back)
+    big_endian_32_t msg_type;        ///< Message type (see rpc::msg_type)
+    big_endian_32_t rpc_version;     ///< RPC protocol version (should be 2, but we can ignore)
+    big_endian_32_t program;         ///< Program code (see rpc::programs)
+    big_endian_32_t program_version; ///< Program version - what version of the program is requested (we can ignore)
+    big_endian_32_t procedure;       ///< Procedure code (see rpc::procedures)
+    big_endian_32_t credentials_l;   ///< Security data (not used in this context)
+    big_endian_32_t credentials_h;   ///< Security data (not used in this context)
+    big_endian_32_t verifier_l;      ///< Security data (not used in this context)
+    big_endian_32_t verifier_h;      ///< Security data (not used in this context)
+    big_endian_32_t handle_len;      ///< Length of the handle
+    char handle[];                   ///< The handle
+};
+
 /*  constant variables used to access the data buffers as the various structures defined above  */
 
 rpc_request_packet *const udp_request = (rpc_request_packet *)udp_request_packet_buffer;     ///< udp_request accesses the udp_request_packet_buffer as a generic rpc request
@@ -388,3 +492,9 @@ read_response_packet *const read_response = (read_response_packet *)vxi_response
 
 write_request_packet *const write_request = (write_request_packet *)vxi_request_packet_buffer;     ///< write_request accesses the vxi_request_packet_buffer as a write request
 write_response_packet *const write_response = (write_response_packet *)vxi_response_packet_buffer; ///< write_response accesses the vxi_response_packet_buffer as a write response
+
+error_response_packet *const error_response = (error_response_packet *)vxi_response_packet_buffer;       ///< error_response accesses the vxi_response_packet_buffer as a response carrying only an error
+readstb_response_packet *const readstb_response = (readstb_response_packet *)vxi_response_packet_buffer; ///< readstb_response accesses the vxi_response_packet_buffer as a read status byte response
+
+enable_srq_request_packet *const enable_srq_request = (enable_srq_request_packet *)vxi_request_packet_buffer;                   ///< enable_srq_request accesses the vxi_request_packet_buffer as an enable SRQ request
+create_intr_chan_request_packet *const create_intr_chan_request = (create_intr_chan_request_packet *)vxi_request_packet_buffer; ///< create_intr_chan_request accesses the vxi_request_packet_buffer as a create interrupt channel request
@@ -42,6 +42,8 @@ void VXI_Server::begin(bool bNext)
 {
     if (bNext) {
         client.stop();
+        intr_client.stop();
+        srq_enabled = false;
 
         if (vxi_port.is_noncyclic()) return; // no need to change port, and the rest is already done
 
@@ -74,13 +76,21 @@ void VXI_Server::begin(bool bNext)
 
 void VXI_Server::loop()
 {
+    if (scpi_handler.take_service_request()) {
+        send_srq();
+    }
+    // Discard the replies to our service requests
+    while (intr_client.available()) {
+        intr_client.read();
+    }
+
     if (client) // if a connection has been established on port
     {
         bool bClose = false;
 
         if (!client.connected()) {
             bClose = true;
-        } else {
+        } else if (!scpi_handler.is_busy()) {
             int len = get_vxi_packet(client);
 
             if (len > 0) {
@@ -126,10 +136,22 @@ bool VXI_Server::handle_packet()
         case rpc::VXI_11_DEV_WRITE:
             write();
             break;
+        case rpc::VXI_11_DEV_READSTB:
+            read_stb();
+            break;
+        case rpc::VXI_11_DEV_ENABLE_SRQ:
+            enable_srq();
+            break;
         case rpc::VXI_11_DESTROY_LINK:
             destroy_link();
             bClose = true;
             break;
+        case rpc::VXI_11_CREATE_INTR_CHAN:
+            create_intr_chan();
+            break;
+        case rpc::VXI_11_DESTROY_INTR_CHAN:
+            destroy_intr_chan();
+            break;
         default:
             LOG_F("Invalid VXI-11 procedure (received %u)\n", (uint32_t)(vxi_request->procedure));
             rc = rpc::PROC_UNAVAIL;
@@ -191,18 +213,23 @@ void VXI_Server::destroy_link()
 void VXI_Server::read()
 {
     // This is where we read from the device
-    char outbuffer[256];
+    // The reply must fit in the send buffer, padded to a multiple of 4
+    const size_t max_data_len = (VXI_SEND_SIZE - 4 - sizeof(read_response_packet)) & ~3u;
+    size_t max_len = (uint32_t)read_request->request_size;
+    if (max_len == 0 || max_len > max_data_len) {
+        max_len = max_data_len;
+    }
     size_t len = 0;
-    scpi_result_t rv = scpi_handler.read(outbuffer, &len, sizeof(outbuffer));
+    bool end = true;
+    scpi_result_t rv = scpi_handler.read(read_response->data, &len, max_len, &end);
 
     // FIXME handle error codes, maybe even pick up errors from the SCPI Parser
 
-    LOG_F("READ DATA on port %u; data sent = %.*s\n", (uint32_t)vxi_port, (int)len, outbuffer);
+    LOG_F("READ DATA on port %u; data sent = %.*s\n", (uint32_t)vxi_port, (int)len, read_response->data);
     read_response->rpc_status = rpc::SUCCESS;
     read_response->error = rpc::NO_ERROR;
-    read_response->reason = rpc::END;
+    read_response->reason = end ? rpc::END : rpc::REQCNT;
     read_response->data_len = (uint32_t)len;
-    strcpy(read_response->data, outbuffer);
 
     send_vxi_packet(client, sizeof(read_response_packet) + len);
 }
@@ -228,6 +255,105 @@ void VXI_Server::write()
     send_vxi_packet(client, sizeof(write_response_packet));
 }
 
+void VXI_Server::read_stb()
+{
+    uint8_t stb = scpi_handler.read_status_byte();
+    LOG_F("READ STB on port %u; stb = 0x%02x\n", (uint32_t)vxi_port, stb);
+    readstb_response->rpc_status = rpc::SUCCESS;
+    readstb_response->error = rpc::NO_ERROR;
+    readstb_response->stb = stb;
+    send_vxi_packet(client, sizeof(readstb_response_packet));
+}
+
+void VXI_Server::enable_srq()
+{
+    uint32_t handle_len = enable_srq_request->handle_len;
+    if (handle_len > sizeof(srq_handle)) {
+        handle_len = sizeof(srq_handle);
+    }
+    srq_enabled = enable_srq_request->enable != 0;
+    memcpy(srq_handle, enable_srq_request->handle, handle_len);
+    srq_handle_len = handle_len;
+    LOG_F("ENABLE SRQ on port %u; enable = %d\n", (uint32_t)vxi_port, srq_enabled);
+    error_response->rpc_status = rpc::SUCCESS;
+    error_response->error = rpc::NO_ERROR;
+    send_vxi_packet(client, sizeof(error_response_packet));
+}
+
+void VXI_Server::create_intr_chan()
+{
+    uint32_t host_addr = create_intr_chan_request->host_addr;
+    uint16_t host_port = (uint32_t)create_intr_chan_request->host_port;
+    IPAddress host(host_addr >> 24, (host_addr >> 16) & 0xff, (host_addr >> 8) & 0xff, host_addr & 0xff);
+    LOG_F("CREATE INTR CHAN on port %u to %s:%u\n", (uint32_t)vxi_port, host.toString().c_str(), host_port);
+
+    error_response->rpc_status = rpc::SUCCESS;
+    if (create_intr_chan_request->prog_family != 0) {
+        // Only TCP is supported
+        error_response->error = rpc::OUT_OF_RESOURCES;
+    } else if (host != client.remoteIP()) {
+        // Only call back the host owning the link
+        error_response->error = rpc::PARAMETER_ERROR;
+    } else if (intr_client.connected()) {
+        error_response->error = rpc::DUPLICATE_CHANNEL;
+    } else {
+        // connect() blocks for up to the timeout
+        intr_client.setTimeout(VXI_INTR_CONNECT_TIMEOUT_MS);
+        if (!intr_client.connect(host, host_port)) {
+            error_response->error = rpc::NO_CHANNEL;
+        } else {
+            intr_client.setNoDelay(true);
+            error_response->error = rpc::NO_ERROR;
+        }
+    }
+    send_vxi_packet(client, sizeof(error_response_packet));
+}
+
+void VXI_Server::destroy_intr_chan()
+{
+    LOG_F("DESTROY INTR CHAN on port %u\n", (uint32_t)vxi_port);
+    error_response->rpc_status = rpc::SUCCESS;
+    error_response->error = intr_client.connected() ? rpc::NO_ERROR : rpc::NO_CHANNEL;
+    intr_client.stop();
+    srq_enabled = false;
+    send_vxi_packet(client, sizeof(error_response_packet));
+}
+
+/*!
+  @brief  Send a service request to the client's interrupt server.
+
+  The request is a one-way RPC call; the reply is discarded in loop().
+*/
+void VXI_Server::send_srq()
+{
+    if (!srq_enabled || !intr_client.connected()) {
+        return;
+    }
+    uint8_t buffer[sizeof(tcp_prefix_packet) + sizeof(intr_srq_request_packet) + sizeof(srq_handle)] = {};
+    tcp_prefix_packet *prefix = (tcp_prefix_packet *)buffer;
+    intr_srq_request_packet *request = (intr_srq_request_packet *)(buffer + sizeof(tcp_prefix_packet));
+
+    request->xid = ++srq_xid;
+    request->msg_type = rpc::CALL;
+    request->rpc_version = 2;
+    request->program = rpc::VXI_11_INTR;
+    request->program_version = 1;
+    request->procedure = rpc::VXI_11_INTR_SRQ;
+    request->credentials_l = 0;
+    request->credentials_h = 0;
+    request->verifier_l = 0;
+    request->verifier_h = 0;
+    request->handle_len = srq_handle_len;
+    memcpy(request->handle, srq_handle, srq_handle_len);
+
+    // adjust length to multiple of 4; the buffer was zero filled
+    uint32_t len = (sizeof(intr_srq_request_packet) + srq_handle_len + 3) & ~3u;
+    prefix->length = 0x80000000 | len; // set the FRAG bit and the length
+    intr_client.write(buffer, len + sizeof(tcp_prefix_packet));
+
+    LOG_F("Sent SRQ to %s:%u\n", intr_client.remoteIP().toString().c_str(), intr_client.remotePort());
+}
+
 const char *VXI_Server::get_visa_resource()
 {
     static char visa_resource[40];
@@ -248,6 +374,8 @@ void VXI_Server::disconnect_client(const IPAddress &ip)
 {
     if (client && client.connected() && client.remoteIP() == ip) {
         client.stop();
+        intr_client.stop();
+        srq_enabled = false;
         scpi_handler.release_control();
     }
 }
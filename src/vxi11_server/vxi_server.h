@@ -6,6 +6,9 @@
 #include <SCPI_Parser.h>
 #include <list>
 
+// Longest wait for the client's interrupt server to accept the channel
+#define VXI_INTR_CONNECT_TIMEOUT_MS 500
+
 /*!
   @brief  Interface with the rest of the device.
 */
@@ -15,12 +18,18 @@ class SCPI_handler_interface
     virtual ~SCPI_handler_interface() {} 
     // write a command to the SCPI parser
     virtual void write(const char *data, size_t len) = 0;
-    // read a response from the SCPI parser
-    virtual scpi_result_t read(char *data, size_t *len, size_t max_len) = 0;
+    // read a response from the SCPI parser, end is false while more of it remains
+    virtual scpi_result_t read(char *data, size_t *len, size_t max_len, bool *end) = 0;
     // claim_control() should return true if the SCPI parser is ready to accept a command
     virtual bool claim_control() = 0;
     // release_control() should be called when the SCPI parser is no longer needed
     virtual void release_control() = 0;
+    // read the IEEE 488.2 status byte
+    virtual uint8_t read_status_byte() = 0;
+    // take_service_request() returns true once for each service request raised by the SCPI parser
+    virtual bool take_service_request() = 0;
+    // is_busy() returns true while *OPC? or *WAI holds back the last write; no further requests are read
+    virtual bool is_busy() = 0;
 };
 
 /*!
@@ -56,6 +65,11 @@ class VXI_Server
     void destroy_link();
     void read();
     void write();
+    void read_stb();
+    void enable_srq();
+    void create_intr_chan();
+    void destroy_intr_chan();
+    void send_srq();
     bool handle_packet();
     void parse_scpi(char *buffer);
 
@@ -65,5 +79,12 @@ class VXI_Server
     uint32_t rw_channel;
     cyclic_uint32_t vxi_port;
     SCPI_handler_interface &scpi_handler;
+
+    // Interrupt channel used to deliver service requests to the client
+    WiFiClient intr_client;
+    bool srq_enabled = false;
+    char srq_handle[40];
+    uint32_t srq_handle_len = 0;
+    uint32_t srq_xid = 0;
 };
 